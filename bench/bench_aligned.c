@@ -0,0 +1,146 @@
+#include "alloc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/**
+ * Benchmark aligned allocation against aligning by hand
+ *
+ * The hand-aligned variant over-allocates by the alignment and rounds the
+ * pointer up, which is what callers had to do before tualigned_alloc. Both
+ * run the same alloc/free churn of small cache-line aligned objects, each
+ * run in a fresh forked child with the variants taking turns going first.
+ * The benchmark fails if tualigned_alloc is slower on average. Then
+ * tualigned_alloc is checked on sizes up to the mapped range together with
+ * turealloc and tufree.
+ */
+
+#define SLOTS 4096 /**< Number of live objects kept by the churn */
+#define OPS 200000 /**< Number of replace operations per run */
+#define ALIGN 64 /**< Alignment used by the churn */
+#define ROUNDS 10 /**< Runs of each variant */
+
+static void *slots[SLOTS]; /**< The live objects, as returned by the allocator */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Replace random objects with new ones of random small size
+ *
+ * @param aligned Use tualigned_alloc instead of over-allocating
+ * @return The time taken in seconds
+ */
+static double churn(int aligned) {
+    unsigned seed = 1;
+    double start = now();
+    for (int i = 0; i < OPS; i++) {
+        int slot = rand_r(&seed) % SLOTS;
+        size_t size = ALIGN * (1 + rand_r(&seed) % 4);
+        tufree(slots[slot]);
+        char *obj;
+        if (aligned) {
+            slots[slot] = obj = tualigned_alloc(ALIGN, size);
+        } else {
+            slots[slot] = tumalloc(size + ALIGN - 1);
+            obj = (char *)(((uintptr_t)slots[slot] + ALIGN - 1) & ~(uintptr_t)(ALIGN - 1));
+        }
+        if (obj == NULL || (uintptr_t)obj % ALIGN != 0) {
+            fprintf(stderr, "bad allocation\n");
+            exit(1);
+        }
+        obj[0] = (char)i;
+    }
+    double elapsed = now() - start;
+    for (int i = 0; i < SLOTS; i++) {
+        tufree(slots[i]);
+        slots[i] = NULL;
+    }
+    return elapsed;
+}
+
+/**
+ * Check alignment, turealloc and tufree across the size ranges
+ *
+ * @return The number of failed checks
+ */
+static int check(void) {
+    int failures = 0;
+    size_t aligns[] = {32, 64, 128, 4096, 65536};
+    size_t sizes[] = {1, 100, 512, 4000, 200000, 3000000};
+    for (size_t i = 0; i < sizeof(aligns) / sizeof(aligns[0]); i++) {
+        for (size_t j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+            void *ptr = NULL;
+            if (tuposix_memalign(&ptr, aligns[i], sizes[j]) != 0 || (uintptr_t)ptr % aligns[i] != 0) {
+                fprintf(stderr, "align %zu size %zu: bad pointer %p\n", aligns[i], sizes[j], ptr);
+                failures++;
+                continue;
+            }
+            memset(ptr, 0x5a, sizes[j]);
+            char *grown = turealloc(ptr, sizes[j] * 2);
+            if (grown == NULL || grown[sizes[j] - 1] != 0x5a) {
+                fprintf(stderr, "align %zu size %zu: turealloc lost data\n", aligns[i], sizes[j]);
+                failures++;
+            }
+            tufree(grown);
+        }
+    }
+    return failures;
+}
+
+int main(void) {
+    // Time of every run, by variant
+    double *times = mmap(NULL, 2 * ROUNDS * sizeof(double), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (times == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    // Every other round the aligned variant goes first
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int turn = 0; turn < 2; turn++) {
+            int aligned = turn ^ (round & 1);
+            fflush(NULL);
+            pid_t pid = fork();
+            if (pid == 0) {
+                times[aligned * ROUNDS + round] = churn(aligned);
+                _exit(0);
+            }
+            int status;
+            if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                return 1;
+            }
+        }
+    }
+
+    double by_hand = 0, aligned = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        by_hand += times[round] / ROUNDS;
+        aligned += times[ROUNDS + round] / ROUNDS;
+    }
+    munmap(times, 2 * ROUNDS * sizeof(double));
+    int failures = check();
+
+    fprintf(stderr, "over-allocate: %7.1f ns/op  (mean of %d)\n", by_hand * 1e9 / OPS, ROUNDS);
+    fprintf(stderr, "tualigned:     %7.1f ns/op  (mean of %d)\n", aligned * 1e9 / OPS, ROUNDS);
+    if (aligned > by_hand) {
+        fprintf(stderr, "tualigned_alloc is slower than over-allocating\n");
+        failures++;
+    }
+    fprintf(stderr, "%d failed checks\n", failures);
+    return failures != 0;
+}
@@ -0,0 +1,117 @@
+#include "alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/**
+ * Benchmark building and freeing a linked list in batches
+ *
+ * Builds a list of NODES nodes like src/main.c does, once with a tumalloc
+ * call per node and once with a single tumalloc_batch, then frees it with
+ * tufree per node or with tufree_batch. Every run is a fresh forked child,
+ * so both variants start from an empty heap, and they take turns going
+ * first.
+ */
+
+#define NODES 1000000 /**< Number of list nodes */
+#define ROUNDS 4 /**< Runs of each variant */
+
+/**
+ * A list node, as in src/main.c
+ */
+typedef struct node {
+    int data; /**< The data stored in the list */
+    struct node *next; /**< The next element in the list */
+} node;
+
+static void *nodes[NODES]; /**< The nodes, in list order */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Build a list, then free it, timing both
+ *
+ * @param batch Use the batch calls instead of a call per node
+ * @param build Set to the time taken to allocate and link the nodes
+ * @param destroy Set to the time taken to free the nodes
+ */
+static void run(int batch, double *build, double *destroy) {
+    double start = now();
+    if (batch) {
+        if (tumalloc_batch(sizeof(node), NODES, nodes) != NODES) {
+            fprintf(stderr, "tumalloc_batch failed\n");
+            exit(1);
+        }
+    } else {
+        for (int i = 0; i < NODES; i++) {
+            nodes[i] = tumalloc(sizeof(node));
+        }
+    }
+    for (int i = 0; i < NODES; i++) {
+        node *n = nodes[i];
+        n->data = i;
+        n->next = i + 1 < NODES ? nodes[i + 1] : NULL;
+    }
+    *build = now() - start;
+
+    start = now();
+    if (batch) {
+        tufree_batch(nodes, NODES);
+    } else {
+        for (int i = 0; i < NODES; i++) {
+            tufree(nodes[i]);
+        }
+    }
+    *destroy = now() - start;
+}
+
+int main(void) {
+    // Build and free times of every run, by variant
+    double *times = mmap(NULL, 2 * ROUNDS * 2 * sizeof(double), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                         -1, 0);
+    if (times == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    // Every other round the batch variant goes first
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int turn = 0; turn < 2; turn++) {
+            int batch = turn ^ (round & 1);
+            double *slot = times + (batch * ROUNDS + round) * 2;
+            fflush(NULL);
+            pid_t pid = fork();
+            if (pid == 0) {
+                run(batch, &slot[0], &slot[1]);
+                _exit(0);
+            }
+            waitpid(pid, NULL, 0);
+        }
+    }
+
+    const char *names[] = {"single calls:", "batch calls: "};
+    for (int batch = 0; batch < 2; batch++) {
+        double build = 0, destroy = 0;
+        for (int round = 0; round < ROUNDS; round++) {
+            build += times[(batch * ROUNDS + round) * 2];
+            destroy += times[(batch * ROUNDS + round) * 2 + 1];
+        }
+        fprintf(stderr, "%s build %7.1f ms  free %7.1f ms  (mean of %d)\n", names[batch], build / ROUNDS * 1e3,
+                destroy / ROUNDS * 1e3, ROUNDS);
+    }
+    munmap(times, 2 * ROUNDS * 2 * sizeof(double));
+    return 0;
+}
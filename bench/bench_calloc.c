@@ -0,0 +1,116 @@
+#include "alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Benchmark tucalloc on memory known to be zero
+ *
+ * Times zeroed allocations of mapped and of heap-sized blocks on a fresh
+ * heap, against tumalloc followed by memset. Then reused, dirty blocks are
+ * checked to still come back cleared.
+ */
+
+#define LARGE_BLOCKS 64 /**< Number of mapped blocks per run */
+#define LARGE_SIZE (4 * 1024 * 1024) /**< Size of a mapped block */
+#define HEAP_BLOCKS 1024 /**< Number of heap blocks per run */
+#define HEAP_SIZE (64 * 1024) /**< Size of a heap block */
+
+static void *blocks[HEAP_BLOCKS]; /**< The blocks of a run */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Allocate zeroed blocks, keeping them live
+ *
+ * @param count Number of blocks
+ * @param size Size of every block
+ * @param use_calloc Use tucalloc instead of tumalloc and memset
+ * @return The time taken in seconds
+ */
+static double zeroed(int count, size_t size, int use_calloc) {
+    double start = now();
+    for (int i = 0; i < count; i++) {
+        if (use_calloc) {
+            blocks[i] = tucalloc(1, size);
+        } else {
+            blocks[i] = tumalloc(size);
+            memset(blocks[i], 0, size);
+        }
+    }
+    return now() - start;
+}
+
+/**
+ * Free the blocks of a run
+ *
+ * @param count Number of blocks
+ */
+static void release(int count) {
+    for (int i = 0; i < count; i++) {
+        tufree(blocks[i]);
+    }
+}
+
+/**
+ * Check that dirty reused blocks are cleared
+ *
+ * @return The number of failed checks
+ */
+static int check(void) {
+    int failures = 0;
+    size_t sizes[] = {100, 4000, HEAP_SIZE, LARGE_SIZE};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        char *dirty = tumalloc(sizes[i]);
+        memset(dirty, 0xa5, sizes[i]);
+        tufree(dirty);
+
+        char *ptr = tucalloc(sizes[i], 1);
+        for (size_t j = 0; ptr && j < sizes[i]; j++) {
+            if (ptr[j] != 0) {
+                fprintf(stderr, "size %zu: byte %zu not cleared\n", sizes[i], j);
+                failures++;
+                break;
+            }
+        }
+        tufree(ptr);
+    }
+    if (tucalloc((size_t)1 << 40, (size_t)1 << 40) != NULL) {
+        fprintf(stderr, "overflowing tucalloc succeeded\n");
+        failures++;
+    }
+    return failures;
+}
+
+int main(void) {
+    // Fresh memory first: calloc before malloc+memset, so neither reuses the other's blocks
+    double large_calloc = zeroed(LARGE_BLOCKS, LARGE_SIZE, 1);
+    release(LARGE_BLOCKS);
+    double heap_calloc = zeroed(HEAP_BLOCKS, HEAP_SIZE, 1);
+    tustats stats;
+    tumalloc_stats(&stats);
+    double large_memset = zeroed(LARGE_BLOCKS, LARGE_SIZE, 0);
+    release(LARGE_BLOCKS);
+    double heap_memset = zeroed(HEAP_BLOCKS, HEAP_SIZE, 0);
+    release(HEAP_BLOCKS);
+    int failures = check();
+
+    fprintf(stderr, "%d x %d KiB mapped: tucalloc %7.2f ms  tumalloc+memset %7.2f ms\n",
+            LARGE_BLOCKS, LARGE_SIZE / 1024, large_calloc * 1e3, large_memset * 1e3);
+    fprintf(stderr, "%d x %d KiB heap:   tucalloc %7.2f ms  tumalloc+memset %7.2f ms\n",
+            HEAP_BLOCKS, HEAP_SIZE / 1024, heap_calloc * 1e3, heap_memset * 1e3);
+    fprintf(stderr, "%zu MiB not cleared by tucalloc\n", stats.calloc_bytes_skipped >> 20);
+    fprintf(stderr, "%d failed checks\n", failures);
+    return failures != 0;
+}
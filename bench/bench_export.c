@@ -0,0 +1,130 @@
+#include "alloc.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/**
+ * Measure what publishing statistics to shared memory costs
+ *
+ * THREADS threads churn small blocks through tumalloc and tufree, without
+ * exporting and after tumalloc_stats_export with opt.export_ms at 1, and
+ * the mean time per pair of each is reported. Every run is a fresh forked
+ * child and the two take turns going first, so neither gains from the
+ * order. The segment of the last exporting run is then read
+ * back with `tustat /dev/shm/bench_export.tustats`, which should show the
+ * process's pid and a recent publish.
+ */
+
+#define THREADS 4 /**< Number of churning threads */
+#define OPS 1000000 /**< tumalloc/tufree pairs per thread */
+#define LIVE 256 /**< Blocks each thread keeps live */
+#define SEGMENT "/dev/shm/bench_export.tustats" /**< Where the statistics are published */
+#define ROUNDS 4 /**< Runs with and without exporting each */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Churn small blocks
+ *
+ * @param arg Unused
+ * @return NULL
+ */
+static void *churn(void *arg) {
+    (void)arg;
+    void *live[LIVE] = {0};
+    unsigned seed = (unsigned)(size_t)&live;
+    for (int i = 0; i < OPS; i++) {
+        int slot = rand_r(&seed) % LIVE;
+        tufree(live[slot]);
+        live[slot] = tumalloc(16 + rand_r(&seed) % 512);
+    }
+    for (int i = 0; i < LIVE; i++) {
+        tufree(live[i]);
+    }
+    return NULL;
+}
+
+/**
+ * Run the churn on all threads
+ *
+ * @return The time per pair in ns
+ */
+static double run(void) {
+    pthread_t threads[THREADS];
+    double start = now();
+    for (int i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, churn, NULL);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    return (now() - start) * 1e9 / ((double)OPS * THREADS);
+}
+
+/**
+ * Run the churn in a fresh child process
+ *
+ * @param export Publish the statistics to SEGMENT during the run
+ * @param out Receives the time per pair in ns, -1 if exporting failed
+ */
+static void run_child(int export, double *out) {
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (export) {
+            size_t ms = 1;
+            tumallctl("opt.export_ms", NULL, NULL, &ms, sizeof(ms));
+            if (tumalloc_stats_export(SEGMENT) < 0) {
+                perror(SEGMENT);
+                *out = -1;
+                _exit(1);
+            }
+        }
+        *out = run();
+        fflush(NULL);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+int main(void) {
+    double *ns = mmap(NULL, 2 * ROUNDS * sizeof(double), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ns == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    // Every other round the exporting run goes first
+    double off = 0, on = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int turn = 0; turn < 2; turn++) {
+            int export = turn ^ (round & 1);
+            run_child(export, &ns[export * ROUNDS + round]);
+        }
+        if (ns[ROUNDS + round] < 0) {
+            return 1;
+        }
+        off += ns[round] / ROUNDS;
+        on += ns[ROUNDS + round] / ROUNDS;
+    }
+    munmap(ns, 2 * ROUNDS * sizeof(double));
+
+    fprintf(stderr, "export off: %6.1f ns per pair\n", off);
+    fprintf(stderr, "export on:  %6.1f ns per pair (%+.2f%%), published to %s\n", on, (on - off) / off * 100,
+            SEGMENT);
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include "alloc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/**
+ * Compare the free-list fit policies selected through tumallctl
+ *
+ * Each policy runs in its own forked child on a fresh heap. The workload
+ * keeps a pool of medium blocks of random size and replaces random ones,
+ * which fragments the free list. The time per operation, how far the
+ * heap had to grow, how many free blocks a search visits and how often it
+ * falls back to growing the heap are reported. A run also reads back a few tunables and
+ * statistics by name.
+ */
+
+#define SLOTS 2048 /**< Number of live blocks */
+#define OPS 50000 /**< Number of replace operations per run */
+#define MIN_SIZE 1024 /**< Smallest block, above the size-class bins */
+#define MAX_SIZE 16384 /**< Largest block */
+
+static void *slots[SLOTS]; /**< The live blocks */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Run the workload with one fit policy
+ *
+ * @param fit The policy name for opt.fit
+ */
+static void run(const char *fit) {
+    if (tumallctl("opt.fit", NULL, NULL, &fit, sizeof(fit)) != 0) {
+        fprintf(stderr, "%s: tumallctl failed\n", fit);
+        return;
+    }
+
+    unsigned seed = 1;
+    char *heap_start = sbrk(0);
+    double start = now();
+    for (int i = 0; i < OPS; i++) {
+        int slot = rand_r(&seed) % SLOTS;
+        tufree(slots[slot]);
+        slots[slot] = tumalloc(MIN_SIZE + rand_r(&seed) % (MAX_SIZE - MIN_SIZE));
+    }
+    double elapsed = now() - start;
+    size_t grown = (size_t)((char *)sbrk(0) - heap_start);
+
+    const char *current;
+    size_t len = sizeof(current);
+    size_t threshold;
+    size_t threshold_len = sizeof(threshold);
+    size_t copied;
+    size_t copied_len = sizeof(copied);
+    if (tumallctl("opt.fit", &current, &len, NULL, 0) != 0 ||
+        tumallctl("opt.mmap_threshold", &threshold, &threshold_len, NULL, 0) != 0 ||
+        tumallctl("stats.realloc_bytes_copied", &copied, &copied_len, NULL, 0) != 0 ||
+        tumallctl("arena.0.purge", NULL, NULL, NULL, 0) != 0) {
+        fprintf(stderr, "%s: reading back failed\n", fit);
+    }
+
+    fprintf(stderr, "%-5s fit: %8.1f ns/op  heap grew %6.1f MiB  (opt.fit=%s, threshold %zu KiB)\n",
+            fit, elapsed * 1e9 / OPS, grown / 1048576.0, current, threshold / 1024);
+
+    tustats stats;
+    tumalloc_stats(&stats);
+    size_t searches = stats.search_hits + stats.search_misses;
+    fprintf(stderr, "      mean depth %.1f  sbrk fallback %.2f%%  wasted %.1f B/fit\n      depth:",
+            (double)stats.search_visited / searches, 100.0 * stats.search_misses / searches,
+            (double)stats.fit_wasted_bytes / stats.search_hits);
+    for (int i = 0; i < TUSTATS_SEARCH_BUCKETS; i++) {
+        if (stats.search_depth[i]) {
+            fprintf(stderr, " <%d:%zu", 1 << i, stats.search_depth[i]);
+        }
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(void) {
+    const char *fits[] = {"next", "first", "best"};
+    for (size_t i = 0; i < sizeof(fits) / sizeof(fits[0]); i++) {
+        fflush(NULL);
+        pid_t pid = fork();
+        if (pid == 0) {
+            run(fits[i]);
+            fflush(NULL);
+            _exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Report arena fragmentation through a fragmenting workload
+ *
+ * Allocates BLOCKS medium and small blocks of random size, frees every
+ * other one, which leaves the free memory in holes no larger than a
+ * block, then frees the rest so the holes merge again. tumalloc_frag is
+ * read after each phase and timed, to show it costs the same on a heap of
+ * any size.
+ */
+
+#define BLOCKS 20000 /**< Number of blocks allocated */
+#define READS 100000 /**< Calls to tumalloc_frag to time */
+
+static void *blocks[BLOCKS]; /**< The live blocks */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Print the fragmentation of the main heap
+ *
+ * @param phase What the workload just did
+ */
+static void report(const char *phase) {
+    tufrag frag;
+    tumalloc_frag(0, &frag);
+    fprintf(stderr, "%s:\n", phase);
+    fprintf(stderr, "  footprint %zu  free %zu in %zu blocks  largest %zu  external %.3f\n", frag.footprint,
+            frag.free_bytes, frag.free_blocks, frag.largest_free, frag.external);
+    fprintf(stderr, "  live %zu blocks  headers %zu  rounding %zu  metadata %zu  cached %zu\n", frag.live_blocks,
+            frag.header_bytes, frag.rounding_bytes, frag.metadata_bytes, frag.cached_bytes);
+}
+
+int main(void) {
+    unsigned seed = 1;
+    for (int i = 0; i < BLOCKS; i++) {
+        size_t size = rand_r(&seed) % 4 ? 1 + rand_r(&seed) % 4000 : 1 + rand_r(&seed) % 500;
+        blocks[i] = tumalloc(size);
+    }
+    report("allocated");
+
+    for (int i = 0; i < BLOCKS; i += 2) {
+        tufree(blocks[i]);
+    }
+    report("every other block freed");
+
+    tufrag frag;
+    double start = now();
+    for (int i = 0; i < READS; i++) {
+        tumalloc_frag(0, &frag);
+    }
+    double elapsed = now() - start;
+
+    for (int i = 1; i < BLOCKS; i += 2) {
+        tufree(blocks[i]);
+    }
+    report("all freed");
+
+    fprintf(stderr, "tumalloc_frag: %.0f ns per call\n", elapsed / READS * 1e9);
+    return 0;
+}
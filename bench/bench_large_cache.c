@@ -0,0 +1,111 @@
+#include "alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/**
+ * Benchmark alloc/free cycles of 4 MiB buffers
+ *
+ * Compares a raw mmap/munmap cycle against tumalloc/tufree, which reuses
+ * released mappings from its cache. Every page of the buffer is touched so
+ * page faults are part of the measured cost. Then checks that a cached
+ * mapping older than opt.large_cache_decay_ms is unmapped by the next
+ * large allocation, and exits with 1 if it stays cached.
+ */
+
+#define BUF_SIZE (4 * 1024 * 1024) /**< Size of each buffer */
+#define CYCLES 2000 /**< Number of alloc/free cycles per run */
+#define DECAY_MS 20 /**< Mapping age limit set for the expiry check */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Write one byte to every page of a buffer
+ *
+ * @param buf The buffer to touch
+ * @param len The length of the buffer
+ * @param page The page size
+ */
+static void touch(char *buf, size_t len, size_t page) {
+    for (size_t off = 0; off < len; off += page) {
+        buf[off] = (char)off;
+    }
+}
+
+/**
+ * Check that an aged mapping leaves the cache without another large free
+ *
+ * @return 1 if the mapping is cached and then unmapped, 0 otherwise
+ */
+static int check_expiry(void) {
+    size_t decay = DECAY_MS, old_decay;
+    size_t len = sizeof(old_decay);
+    tumallctl("opt.large_cache_decay_ms", &old_decay, &len, &decay, sizeof(decay));
+
+    tufree(tumalloc(BUF_SIZE));
+    tustats freed;
+    tumalloc_stats(&freed);
+
+    struct timespec wait = {0, DECAY_MS * 2 * 1000000};
+    nanosleep(&wait, NULL);
+    char *other = tumalloc(BUF_SIZE * 2);
+    tustats aged;
+    tumalloc_stats(&aged);
+    tufree(other);
+
+    tumallctl("opt.large_cache_decay_ms", NULL, NULL, &old_decay, sizeof(old_decay));
+    fprintf(stderr, "after free: %zu mappings cached, %d ms later: %zu\n", freed.large_cache_mappings,
+            DECAY_MS * 2, aged.large_cache_mappings);
+    return freed.large_cache_mappings == 1 && aged.large_cache_mappings == 0;
+}
+
+int main(int argc, char **argv) {
+    int cycles = argc > 1 ? atoi(argv[1]) : CYCLES;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    double start = now();
+    for (int i = 0; i < cycles; i++) {
+        char *buf = mmap(NULL, BUF_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf == MAP_FAILED) {
+            fprintf(stderr, "mmap failed\n");
+            return 1;
+        }
+        touch(buf, BUF_SIZE, page);
+        munmap(buf, BUF_SIZE);
+    }
+    double raw = now() - start;
+
+    start = now();
+    for (int i = 0; i < cycles; i++) {
+        char *buf = tumalloc(BUF_SIZE);
+        if (buf == NULL) {
+            fprintf(stderr, "tumalloc failed\n");
+            return 1;
+        }
+        touch(buf, BUF_SIZE, page);
+        tufree(buf);
+    }
+    double cached = now() - start;
+
+    tustats stats;
+    tumalloc_stats(&stats);
+
+    fprintf(stderr, "mmap/munmap:     %8.2f us/cycle\n", raw * 1e6 / cycles);
+    fprintf(stderr, "tumalloc/tufree: %8.2f us/cycle\n", cached * 1e6 / cycles);
+    fprintf(stderr, "cache hits %zu, misses %zu, cached %zu bytes in %zu mappings\n",
+            stats.large_cache_hits, stats.large_cache_misses,
+            stats.large_cache_bytes, stats.large_cache_mappings);
+    return check_expiry() ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+#include "alloc.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Report allocator latency percentiles
+ *
+ * Runs THREADS threads doing a mix of small, medium and large tumalloc,
+ * turealloc and tufree calls, then prints p50/p99/p999/max for each
+ * operation and size group from tumalloc_stats. The histograms are only
+ * filled when the library is configured with -DTUMALLOC_LATENCY=ON;
+ * without it the table is all zero, and comparing the run time of both
+ * builds shows what the timing costs.
+ */
+
+#define THREADS 4 /**< Number of allocating threads */
+#define OPS 200000 /**< Allocations per thread */
+#define LIVE 1024 /**< Blocks each thread keeps live at a time */
+
+/**
+ * Allocate, grow and free a mix of block sizes
+ *
+ * @param arg The thread number
+ * @return NULL
+ */
+static void *churn(void *arg) {
+    void *live[LIVE] = {0};
+    unsigned seed = (unsigned)(size_t)arg + 1;
+    for (int i = 0; i < OPS; i++) {
+        int slot = rand_r(&seed) % LIVE;
+        tufree(live[slot]);
+        size_t size;
+        switch (rand_r(&seed) % 32) {
+        case 0:
+            size = 128 * 1024 + rand_r(&seed) % (512 * 1024);
+            break;
+        case 1:
+        case 2:
+        case 3:
+            size = 600 + rand_r(&seed) % 8000;
+            break;
+        default:
+            size = 1 + rand_r(&seed) % 512;
+            break;
+        }
+        live[slot] = tumalloc(size);
+        if (i % 16 == 0) {
+            live[slot] = turealloc(live[slot], size + size / 2);
+        }
+    }
+    for (int i = 0; i < LIVE; i++) {
+        tufree(live[i]);
+    }
+    return NULL;
+}
+
+int main(void) {
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, churn, (void *)(size_t)i);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    tustats stats;
+    tumalloc_stats(&stats);
+    static const char *ops[TULAT_OPS] = {"tumalloc", "tufree", "turealloc"};
+    static const char *groups[TULAT_SIZES] = {"small", "medium", "large"};
+    fprintf(stderr, "%-10s %-7s %9s %9s %9s %9s %11s\n", "op", "size", "count", "p50 ns", "p99 ns", "p999 ns",
+            "max ns");
+    for (int op = 0; op < TULAT_OPS; op++) {
+        for (int group = 0; group < TULAT_SIZES; group++) {
+            tulatency *lat = &stats.latency[op][group];
+            fprintf(stderr, "%-10s %-7s %9zu %9llu %9llu %9llu %11llu\n", ops[op], groups[group], lat->count,
+                    (unsigned long long)lat->p50, (unsigned long long)lat->p99, (unsigned long long)lat->p999,
+                    (unsigned long long)lat->max);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+#define _GNU_SOURCE /**< For RUSAGE_THREAD */
+
+#include "alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/**
+ * Count minor page faults during steady-state churn
+ *
+ * Runs the same allocation churn on the main heap and on a locked arena
+ * after a warm-up pass, and reports the minor faults taken by the calling
+ * thread while churning. On the locked arena the count should be zero.
+ */
+
+#define RESERVE (64 * 1024 * 1024) /**< Bytes pinned by the locked arena up front */
+#define SLOTS 1024 /**< Number of live buffers kept by the churn */
+#define OPS 100000 /**< Number of replace operations per churn pass */
+
+static char *slots[SLOTS]; /**< The live buffers */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Get the number of minor faults taken by the calling thread
+ *
+ * @return The fault count
+ */
+static long minor_faults(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_minflt;
+}
+
+/**
+ * Replace random buffers with new ones of random size, writing every byte
+ *
+ * @param seed The random seed, the same for the warm-up and measured pass
+ */
+static void churn(unsigned seed) {
+    for (int i = 0; i < OPS; i++) {
+        int slot = rand_r(&seed) % SLOTS;
+        // Mostly small messages, the occasional large snapshot
+        size_t size = rand_r(&seed) % 64 == 0 ? 128 * 1024 + rand_r(&seed) % (128 * 1024)
+                                              : 16 + rand_r(&seed) % 2048;
+        tufree(slots[slot]);
+        slots[slot] = tumalloc(size);
+        memset(slots[slot], i, size);
+    }
+}
+
+/**
+ * Warm up, then measure a churn pass
+ *
+ * @param name The name of the configuration
+ */
+static void run(const char *name) {
+    churn(1);
+    long faults = minor_faults();
+    double start = now();
+    churn(1);
+    double elapsed = now() - start;
+    faults = minor_faults() - faults;
+
+    for (int i = 0; i < SLOTS; i++) {
+        tufree(slots[i]);
+        slots[i] = NULL;
+    }
+    fprintf(stderr, "%-12s %8ld minor faults  %7.1f ns/op\n", name, faults, elapsed * 1e9 / OPS);
+}
+
+int main(void) {
+    run("main heap");
+
+    int index = tuarena_create_locked(RESERVE);
+    if (index < 0 || tuarena_bind((unsigned)index) != 0) {
+        fprintf(stderr, "cannot create a locked arena\n");
+        return 1;
+    }
+    run("locked arena");
+
+    tustats stats;
+    tumalloc_stats(&stats);
+    fprintf(stderr, "locked %zu bytes, unpinned %zu bytes\n", stats.locked_bytes, stats.unpinned_bytes);
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include "alloc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Benchmark the tumallocx fast path and check its flags
+ *
+ * Times the same small alloc/free churn through tumalloc and through
+ * tumallocx without flags, which should cost the same. Then zeroing,
+ * alignment, arena selection, the thread cache bypass and in-place
+ * turallocx are checked.
+ */
+
+#define SLOTS 4096 /**< Number of live objects kept by the churn */
+#define OPS 500000 /**< Number of replace operations per run */
+
+static void *slots[SLOTS]; /**< The live objects */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Replace random objects with new ones of random small size
+ *
+ * @param extended Use tumallocx with no flags instead of tumalloc
+ * @return The time taken in seconds
+ */
+static double churn(int extended) {
+    unsigned seed = 1;
+    double start = now();
+    for (int i = 0; i < OPS; i++) {
+        int slot = rand_r(&seed) % SLOTS;
+        size_t size = 16 * (1 + rand_r(&seed) % 16);
+        tufree(slots[slot]);
+        slots[slot] = extended ? tumallocx(size, 0) : tumalloc(size);
+    }
+    double elapsed = now() - start;
+    for (int i = 0; i < SLOTS; i++) {
+        tufree(slots[i]);
+        slots[i] = NULL;
+    }
+    return elapsed;
+}
+
+/**
+ * Check that a block is entirely zero
+ *
+ * @param ptr The block
+ * @param len Number of bytes to check
+ * @return 1 if all bytes are zero
+ */
+static int zeroed(const char *ptr, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (ptr[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Check the flags of tumallocx and turallocx
+ *
+ * @return The number of failed checks
+ */
+static int check(void) {
+    int failures = 0;
+    size_t sizes[] = {24, 500, 5000, 300000};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        // Dirty some memory so zeroing has something to do
+        char *dirty = tumalloc(sizes[i]);
+        memset(dirty, 0xa5, sizes[i]);
+        tufree(dirty);
+
+        char *ptr = tumallocx(sizes[i], TUMALLOCX_ZERO | TUMALLOCX_LG_ALIGN(7));
+        if (ptr == NULL || (uintptr_t)ptr % 128 != 0 || !zeroed(ptr, sizes[i])) {
+            fprintf(stderr, "size %zu: bad zeroed aligned block %p\n", sizes[i], (void *)ptr);
+            failures++;
+            continue;
+        }
+        memset(ptr, 0x5a, sizes[i]);
+
+        char *grown = turallocx(ptr, sizes[i] * 3, TUMALLOCX_ZERO);
+        if (grown == NULL || grown[sizes[i] - 1] != 0x5a) {
+            fprintf(stderr, "size %zu: turallocx lost data\n", sizes[i]);
+            failures++;
+        }
+        if (grown && !zeroed(grown + sizes[i] * 2, sizes[i])) {
+            fprintf(stderr, "size %zu: turallocx did not zero the new bytes\n", sizes[i]);
+            failures++;
+        }
+
+        // Shrinking in place always works
+        if (grown && turallocx(grown, sizes[i], TUMALLOCX_NOMOVE) != grown) {
+            fprintf(stderr, "size %zu: in-place shrink failed\n", sizes[i]);
+            failures++;
+        }
+        tufree(grown);
+    }
+
+    // A mapped block either grows where it is or stays untouched
+    char *big = tumalloc(1 << 20);
+    big[0] = 1;
+    char *same = turallocx(big, 4 << 20, TUMALLOCX_NOMOVE);
+    if (same != NULL && same != big) {
+        fprintf(stderr, "TUMALLOCX_NOMOVE moved a mapping\n");
+        failures++;
+    }
+    tufree(big);
+
+    // Bypassing the cache still hands out a usable block of the thread's arena
+    char *uncached = tumallocx(64, TUMALLOCX_NOCACHE | TUMALLOCX_ARENA(0));
+    if (uncached == NULL || tumalloc_usable_size(uncached) < 64) {
+        fprintf(stderr, "TUMALLOCX_NOCACHE failed\n");
+        failures++;
+    }
+    tufree(uncached);
+
+    // Unknown arenas are rejected
+    if (tumallocx(64, TUMALLOCX_ARENA(200)) != NULL) {
+        fprintf(stderr, "TUMALLOCX_ARENA accepted an unknown arena\n");
+        failures++;
+    }
+    return failures;
+}
+
+int main(void) {
+    double plain = churn(0);
+    double extended = churn(1);
+    int failures = check();
+
+    fprintf(stderr, "tumalloc:             %7.1f ns/op\n", plain * 1e9 / OPS);
+    fprintf(stderr, "tumallocx, no flags:  %7.1f ns/op\n", extended * 1e9 / OPS);
+    fprintf(stderr, "%d failed checks\n", failures);
+    return failures != 0;
+}
@@ -0,0 +1,171 @@
+#include "alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Drive the allocator's cgroup awareness with a fake cgroup directory
+ *
+ * Creates memory.max, memory.current and a PSI file in a temporary
+ * directory, steps usage and PSI across the level thresholds and reports
+ * the pressure level, the mapping cache size and the cost of a forced
+ * pressure read at each step. Heap purging is set to start at level 1.
+ * Exits with 1 if a step does not reach the level its usage and PSI call
+ * for, or if a rise in level does not shrink the mapping cache and purge
+ * more heap bytes. No real cgroup is needed.
+ */
+
+#define LIMIT ((size_t)1 << 30) /**< Fake memory.max */
+#define BUF_SIZE (4 * 1024 * 1024) /**< Size of the buffers that fill the mapping cache */
+#define BUFFERS 12 /**< Number of buffers released into the mapping cache per step */
+#define READS 1000 /**< Number of forced pressure reads timed per step */
+#define HEAP_BLOCK (64 * 1024) /**< Size of the free heap blocks available for purging */
+
+static char dir[] = "/tmp/tucgroupXXXXXX"; /**< The fake cgroup directory */
+
+/**
+ * One step of the run and the level it must reach
+ */
+typedef struct fixture {
+    int percent; /**< Usage as a percentage of the limit */
+    double psi; /**< The PSI "some avg10" value */
+    int level; /**< The expected pressure level */
+} fixture;
+
+static const fixture steps[] = {
+    {50, 0, 0}, {79, 0, 0}, {80, 0, 1}, {89, 0, 1}, {90, 0, 2}, {94, 0, 2}, {95, 0, 3}, {97, 0, 3},
+    {50, 0, 0}, {50, 0.9, 0}, {50, 1, 1}, {50, 9.9, 1}, {50, 10, 2}, {50, 39.9, 2}, {50, 40, 3},
+    {82, 15, 2}, {92, 40, 3}, {50, 0, 0},
+}; /**< Steps through every threshold, up and back down */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Write a string to a file in the fake cgroup directory
+ *
+ * @param name The file name
+ * @param text The contents
+ */
+static void write_file(const char *name, const char *text) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "w");
+    if (f) {
+        fputs(text, f);
+        fclose(f);
+    }
+}
+
+/**
+ * Set the fake usage and PSI, then report how the allocator reacts
+ *
+ * @param percent Usage as a percentage of the limit
+ * @param psi The PSI "some avg10" value
+ * @param stats Filled with the statistics after the step
+ * @return The pressure level the allocator settled on
+ */
+static int step(int percent, double psi, tustats *stats) {
+    char text[128];
+    snprintf(text, sizeof(text), "%zu\n", LIMIT / 100 * percent);
+    write_file("memory.current", text);
+    snprintf(text, sizeof(text), "some avg10=%.2f avg60=0.00 avg300=0.00 total=0\n"
+             "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n", psi);
+    write_file("memory.pressure", text);
+    int level = tumalloc_pressure_update();
+
+    // Fill the mapping cache as far as the current level allows
+    void *bufs[BUFFERS];
+    for (int i = 0; i < BUFFERS; i++) {
+        bufs[i] = tumalloc(BUF_SIZE);
+    }
+    for (int i = 0; i < BUFFERS; i++) {
+        tufree(bufs[i]);
+    }
+
+    double start = now();
+    for (int i = 0; i < READS; i++) {
+        level = tumalloc_pressure_update();
+    }
+    double per_read = (now() - start) / READS;
+
+    tumalloc_stats(stats);
+    fprintf(stderr, "usage %3d%%  psi %5.1f  level %d  cached %9zu bytes  purged %9zu bytes  read %6.2f us\n",
+            percent, psi, level, stats->large_cache_bytes, stats->purged_bytes, per_read * 1e6);
+    return level;
+}
+
+int main(void) {
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    char text[64];
+    snprintf(text, sizeof(text), "%zu\n", LIMIT);
+    write_file("memory.max", text);
+    char psi[300];
+    snprintf(psi, sizeof(psi), "%s/memory.pressure", dir);
+    tumalloc_set_cgroup_paths(dir, psi);
+    size_t purge_level = 1;
+    tumallctl("opt.purge_level", NULL, NULL, &purge_level, sizeof(purge_level));
+
+    // Leave some free heap blocks around for the purge to find
+    void *heap[BUFFERS];
+    for (int i = 0; i < BUFFERS; i++) {
+        heap[i] = tumalloc(HEAP_BLOCK);
+    }
+    for (int i = 0; i < BUFFERS; i++) {
+        tufree(heap[i]);
+    }
+
+    int failed = 0;
+    int last_level = 0;
+    tustats last;
+    tumalloc_stats(&last);
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        tustats stats;
+        int level = step(steps[i].percent, steps[i].psi, &stats);
+        if (level != steps[i].level) {
+            fprintf(stderr, "usage %d%% psi %.1f: level %d, expected %d\n", steps[i].percent, steps[i].psi, level,
+                    steps[i].level);
+            failed++;
+        }
+
+        // A higher level must hold fewer cached bytes and purge the heap again
+        if (i > 0 && level > last_level) {
+            if (stats.large_cache_bytes >= last.large_cache_bytes) {
+                fprintf(stderr, "level %d -> %d: cache stayed at %zu bytes\n", last_level, level,
+                        stats.large_cache_bytes);
+                failed++;
+            }
+            if (stats.purged_bytes <= last.purged_bytes) {
+                fprintf(stderr, "level %d -> %d: nothing purged\n", last_level, level);
+                failed++;
+            }
+        }
+        last_level = level;
+        last = stats;
+    }
+
+    char path[300];
+    snprintf(path, sizeof(path), "%s/memory.max", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/memory.current", dir);
+    unlink(path);
+    unlink(psi);
+    rmdir(dir);
+    fprintf(stderr, "pressure levels: %d failed checks\n", failed);
+    return failed ? 1 : 0;
+}
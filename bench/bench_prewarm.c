@@ -0,0 +1,142 @@
+#include "alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/**
+ * Benchmark the latency of the first requests of a fresh process
+ *
+ * Each configuration runs in its own forked child so every run starts with
+ * an untouched heap. A request allocates a few buffers of mixed sizes,
+ * writes them and frees some of them again, like a request handler building
+ * its response.
+ *
+ * The baseline is the reservation without pre-faulting. It leaves the heap
+ * with the same free list as the pre-faulted runs, so their difference to
+ * it is the page faults saved and nothing else. The run without any
+ * reservation is shown too, but it also grows the heap with sbrk on every
+ * miss and searches a different free list.
+ */
+
+#define REQUESTS 10000 /**< Number of requests timed per run */
+#define BUFFERS_PER_REQUEST 4 /**< Number of buffers allocated per request */
+#define PREWARM_BYTES (128 * 1024 * 1024) /**< Size of the reservation */
+
+static double latencies[REQUESTS]; /**< Latency of every request in us */
+
+/**
+ * What one run measured, written by its child into shared memory
+ */
+typedef struct result {
+    int done; /**< Set once the run finished */
+    double total; /**< Time of all requests in ms */
+    double p99; /**< 99th percentile request latency in us */
+    long faults; /**< Minor page faults taken during the requests */
+} result;
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Compare two latencies for qsort
+ */
+static int compare(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Time the first REQUESTS requests after an optional prewarm
+ *
+ * @param name The name of the configuration
+ * @param flags The flags for tumalloc_prewarm, or -1 to skip it
+ * @param out Receives the totals of the run
+ */
+static void run(const char *name, int flags, result *out) {
+    double prewarm = 0;
+    if (flags >= 0) {
+        double start = now();
+        if (tumalloc_prewarm(PREWARM_BYTES, flags) != 0) {
+            fprintf(stderr, "%s: prewarm failed\n", name);
+            return;
+        }
+        prewarm = now() - start;
+    }
+
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    unsigned seed = 1;
+    double total = 0;
+    for (int i = 0; i < REQUESTS; i++) {
+        double start = now();
+        for (int j = 0; j < BUFFERS_PER_REQUEST; j++) {
+            size_t size = 16 + rand_r(&seed) % 4096;
+            char *buf = tumalloc(size);
+            memset(buf, j, size);
+            if (j % 2) {
+                tufree(buf);
+            }
+        }
+        latencies[i] = (now() - start) * 1e6;
+        total += latencies[i];
+    }
+    getrusage(RUSAGE_SELF, &after);
+
+    qsort(latencies, REQUESTS, sizeof(double), compare);
+    out->total = total / 1e3;
+    out->p99 = latencies[REQUESTS * 99 / 100];
+    out->faults = after.ru_minflt - before.ru_minflt;
+    out->done = 1;
+    fprintf(stderr, "%-22s prewarm %7.2f ms  total %7.2f ms  p50 %6.2f us  p99 %6.2f us  max %7.2f us  faults %6ld\n",
+            name, prewarm * 1e3, out->total, latencies[REQUESTS / 2], out->p99, latencies[REQUESTS - 1],
+            out->faults);
+}
+
+int main(void) {
+    const char *names[] = {"no prewarm", "reserve only", "touch", "touch+threads+seed", "populate+seed"};
+    int flags[] = {-1, 0, TUPREWARM_TOUCH, TUPREWARM_TOUCH | TUPREWARM_THREADS | TUPREWARM_SEED,
+                   TUPREWARM_POPULATE | TUPREWARM_SEED};
+    size_t runs = sizeof(flags) / sizeof(flags[0]);
+    size_t baseline = 1;
+
+    result *results = mmap(NULL, runs * sizeof(result), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    for (size_t i = 0; i < runs; i++) {
+        fflush(NULL);
+        pid_t pid = fork();
+        if (pid == 0) {
+            run(names[i], flags[i], &results[i]);
+            fflush(NULL);
+            _exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+
+    // Same reservation and free list as the baseline, so only the fault-in cost differs
+    const result *base = &results[baseline];
+    for (size_t i = baseline + 1; i < runs && base->done; i++) {
+        if (results[i].done) {
+            fprintf(stderr, "%-22s vs %s: total %+7.2f ms  p99 %+6.2f us  faults %+6ld\n", names[i], names[baseline],
+                    results[i].total - base->total, results[i].p99 - base->p99, results[i].faults - base->faults);
+        }
+    }
+    munmap(results, runs * sizeof(result));
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include "alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Measure the heap profiler's overhead and check what it reports
+ *
+ * The workload keeps a slowly growing set of small blocks from one call
+ * site, the "leak", while another call site allocates and frees blocks of
+ * mixed sizes. It runs with opt.prof off and on, alternating, and the
+ * time per operation of each is reported. A profile is then dumped to
+ * PROFILE, and the live bytes it attributes to the leak, scaled by the
+ * sampling rate, are compared with the real number. Heap snapshots are
+ * written before and after the leaking run, for
+ * `tusnapdiff /tmp/bench_prof.before.snap /tmp/bench_prof.after.snap`.
+ */
+
+#define OPS 500000 /**< Allocations per run */
+#define LIVE 1024 /**< Blocks the churn keeps live */
+#define LEAK_EVERY 8 /**< One leaked block per this many operations */
+#define LEAK_SIZE 64 /**< Size of a leaked block */
+#define ROUNDS 3 /**< Off and on runs each */
+#define PROFILE "/tmp/bench_prof.heap" /**< Where the profile is written */
+#define SNAP_BEFORE "/tmp/bench_prof.before.snap" /**< Snapshot taken before the leaking run */
+#define SNAP_AFTER "/tmp/bench_prof.after.snap" /**< Snapshot taken after it */
+
+static void *churn_live[LIVE]; /**< The churn's live blocks */
+static void **leaked; /**< The leaked blocks, freed at the end */
+static size_t nleaked = 0; /**< Number of leaked blocks */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Allocate a block that is kept, the call site the profile should point at
+ *
+ * @return The block
+ */
+__attribute__((noinline)) static void *leak(void) {
+    return tumalloc(LEAK_SIZE);
+}
+
+/**
+ * Run the workload once
+ *
+ * @param prof Whether to sample
+ * @param keep Whether to keep the leaked blocks live
+ * @return The time per operation in ns
+ */
+static double run(size_t prof, int keep) {
+    tumallctl("opt.prof", NULL, NULL, &prof, sizeof(prof));
+    unsigned seed = 1;
+    double start = now();
+    for (int i = 0; i < OPS; i++) {
+        int slot = rand_r(&seed) % LIVE;
+        tufree(churn_live[slot]);
+        churn_live[slot] = tumalloc(rand_r(&seed) % 8 ? 16 + rand_r(&seed) % 256 : 1024 + rand_r(&seed) % 16384);
+        if (i % LEAK_EVERY == 0) {
+            void *p = leak();
+            if (keep) {
+                leaked[nleaked++] = p;
+            } else {
+                tufree(p);
+            }
+        }
+    }
+    return (now() - start) * 1e9 / OPS;
+}
+
+int main(void) {
+    leaked = malloc(sizeof(void *) * (OPS / LEAK_EVERY + 1));
+    double off = 0, on = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+        off += run(0, 0);
+        on += run(1, 0);
+    }
+    tumalloc_snapshot(SNAP_BEFORE);
+    run(1, 1);
+    tumalloc_snapshot(SNAP_AFTER);
+
+    if (tumalloc_prof_dump(PROFILE) != 0) {
+        fprintf(stderr, "cannot write %s\n", PROFILE);
+        return 1;
+    }
+
+    // Live samples of the leak's size, scaled by the rate, estimate the leak
+    FILE *in = fopen(PROFILE, "r");
+    char line[4096];
+    size_t rate = 0, leak_samples = 0, stacks = 0;
+    if (in && fgets(line, sizeof(line), in)) {
+        char *at = strstr(line, "heap_v2/");
+        rate = at ? strtoul(at + 8, NULL, 10) : 0;
+    }
+    while (in && fgets(line, sizeof(line), in) && line[0] != '\n') {
+        size_t count, bytes;
+        if (sscanf(line, "%zu: %zu", &count, &bytes) == 2) {
+            stacks++;
+            if (count && bytes == count * LEAK_SIZE) {
+                leak_samples += count;
+            }
+        }
+    }
+    if (in) {
+        fclose(in);
+    }
+
+    fprintf(stderr, "prof off: %7.1f ns/op\n", off / ROUNDS);
+    fprintf(stderr, "prof on:  %7.1f ns/op  (%+.2f%%)\n", on / ROUNDS, (on - off) / off * 100);
+    fprintf(stderr, "profile: %zu stacks, %zu dropped samples, rate %zu\n", stacks, tumalloc_prof_dropped(), rate);
+    fprintf(stderr, "leak: %zu bytes live, estimated %zu from %zu samples\n", nleaked * LEAK_SIZE,
+            leak_samples * rate, leak_samples);
+
+    for (size_t i = 0; i < nleaked; i++) {
+        tufree(leaked[i]);
+    }
+    free(leaked);
+    return 0;
+}
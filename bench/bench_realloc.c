@@ -0,0 +1,96 @@
+#include "alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Benchmark growing a buffer by doubling it from 1 MiB to 1 GiB
+ *
+ * Compares a copying resize (allocate, memcpy, free) against turealloc,
+ * which remaps the pages of mapped blocks. The newly added half of the
+ * buffer is written after each step, as a growing vector would. Pass the
+ * final size in MiB as the first argument to use a smaller ceiling.
+ */
+
+#define START_SIZE ((size_t)1 << 20) /**< Initial buffer size */
+#define DEFAULT_MAX_MIB 1024 /**< Default final buffer size in MiB */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Grow a buffer by copying it into a fresh allocation
+ *
+ * @param ptr The buffer to grow
+ * @param old_size The current size of the buffer
+ * @param new_size The size to grow to
+ * @param copied Incremented by the number of bytes copied
+ * @return The new buffer or NULL on failure
+ */
+static char *copy_grow(char *ptr, size_t old_size, size_t new_size, size_t *copied) {
+    char *new_ptr = tumalloc(new_size);
+    if (new_ptr) {
+        memcpy(new_ptr, ptr, old_size);
+        *copied += old_size;
+        tufree(ptr);
+    }
+    return new_ptr;
+}
+
+int main(int argc, char **argv) {
+    size_t max_size = (size_t)(argc > 1 ? atoi(argv[1]) : DEFAULT_MAX_MIB) << 20;
+
+    size_t copied = 0;
+    double start = now();
+    char *buf = tumalloc(START_SIZE);
+    memset(buf, 1, START_SIZE);
+    for (size_t size = START_SIZE; size < max_size && buf; size *= 2) {
+        buf = copy_grow(buf, size, size * 2, &copied);
+        if (buf) {
+            memset(buf + size, 1, size);
+        }
+    }
+    double copy_time = now() - start;
+    if (buf == NULL) {
+        fprintf(stderr, "copying growth failed\n");
+        return 1;
+    }
+    tufree(buf);
+
+    tustats before;
+    tumalloc_stats(&before);
+    start = now();
+    buf = tumalloc(START_SIZE);
+    memset(buf, 1, START_SIZE);
+    for (size_t size = START_SIZE; size < max_size && buf; size *= 2) {
+        buf = turealloc(buf, size * 2);
+        if (buf) {
+            memset(buf + size, 1, size);
+        }
+    }
+    double remap_time = now() - start;
+    if (buf == NULL) {
+        fprintf(stderr, "turealloc growth failed\n");
+        return 1;
+    }
+    tufree(buf);
+    tustats after;
+    tumalloc_stats(&after);
+
+    fprintf(stderr, "growing 1 MiB -> %zu MiB\n", max_size >> 20);
+    fprintf(stderr, "copy:       %8.1f ms, %zu bytes copied\n", copy_time * 1e3, copied);
+    fprintf(stderr, "turealloc:  %8.1f ms, %zu bytes copied, %zu remaps\n", remap_time * 1e3,
+            after.realloc_bytes_copied - before.realloc_bytes_copied,
+            after.realloc_remaps - before.realloc_remaps);
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include "alloc.h"
+#include "list.h"
+#include "region.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Benchmark building and tearing down lists in a region
+ *
+ * Runs the list test of src/main.c many times over with its list
+ * functions: build a list, walk it, tear it down. The heap variant takes
+ * nodes from list_heap and frees them with list_remove_all, the region
+ * variant bumps nodes out of a region and resets it. Nodes are appended at
+ * the tail, so list_add does not walk the list.
+ */
+
+#define ROUNDS 2000 /**< Number of lists built and torn down per run */
+#define NODES 500 /**< Number of nodes per list */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Allocate a node from a region
+ *
+ * @param ctx The region
+ * @param size The node size
+ * @return The node, or NULL if the region cannot grow
+ */
+static void *region_alloc(void *ctx, size_t size) {
+    return turegion_alloc(ctx, size);
+}
+
+/**
+ * Leave a node to the region's next reset
+ *
+ * @param ctx The region
+ * @param ptr The node
+ */
+static void region_release(void *ctx, void *ptr) {
+    (void)ctx;
+    (void)ptr;
+}
+
+/**
+ * Build a list node by node, appending at the tail
+ *
+ * @param a The allocator to take the nodes from
+ * @return The head of the list
+ */
+static node *build(const list_allocator *a) {
+    node *head = list_new(a, 0);
+    node *tail = head;
+    for (int i = 1; i < NODES && tail; i++) {
+        tail = list_add(a, tail, i);
+    }
+    if (tail == NULL) {
+        fprintf(stderr, "allocation failed\n");
+        exit(1);
+    }
+    return head;
+}
+
+/**
+ * Build, check and tear down lists
+ *
+ * @param use_region Allocate from a region instead of the heap
+ * @return The time taken in seconds
+ */
+static double run(int use_region) {
+    turegion *region = use_region ? turegion_create(0) : NULL;
+    list_allocator in_region = {region_alloc, region_release, region};
+    const list_allocator *a = use_region ? &in_region : &list_heap;
+    long sum = 0;
+    double start = now();
+    for (int r = 0; r < ROUNDS; r++) {
+        node *list = build(a);
+        for (node *n = list; n; n = n->next) {
+            sum += n->data;
+        }
+        if (region) {
+            turegion_reset(region);
+        } else {
+            list_remove_all(a, list);
+        }
+    }
+    double elapsed = now() - start;
+    turegion_destroy(region);
+
+    if (sum != (long)ROUNDS * NODES * (NODES - 1) / 2) {
+        fprintf(stderr, "lists were corrupted\n");
+        exit(1);
+    }
+    return elapsed;
+}
+
+int main(void) {
+    double heap = run(0);
+    double region = run(1);
+
+    fprintf(stderr, "tumalloc/tufree: %8.1f ns/node\n", heap * 1e9 / ((double)ROUNDS * NODES));
+    fprintf(stderr, "region:          %8.1f ns/node\n", region * 1e9 / ((double)ROUNDS * NODES));
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "alloc.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Check signal-triggered reports while the process keeps allocating
+ *
+ * Sets up reports on SIGUSR2, then keeps a churn of small and large blocks
+ * going while the process signals itself a few times, and waits until the
+ * helper thread has appended every report to REPORT. The time per
+ * allocation is reported, and the report can be read with
+ * `cat /tmp/bench_report.txt`. From another shell the same is done with
+ * `kill -USR2 <pid>`.
+ */
+
+#define SIGNALS 3 /**< Reports asked for */
+#define OPS 200000 /**< tumalloc/tufree pairs between two signals */
+#define LIVE 1024 /**< Blocks kept live */
+#define REPORT "/tmp/bench_report.txt" /**< Where the reports go */
+
+static void *live[LIVE]; /**< The live blocks */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Get the size of the report file
+ *
+ * @return The size in bytes, 0 if it does not exist
+ */
+static off_t report_size(void) {
+    struct stat st;
+    return stat(REPORT, &st) == 0 ? st.st_size : 0;
+}
+
+int main(void) {
+    unlink(REPORT);
+    if (tumalloc_report_on_signal(SIGUSR2, REPORT) != 0) {
+        perror("tumalloc_report_on_signal");
+        return 1;
+    }
+
+    unsigned seed = 1;
+    double start = now();
+    for (int s = 0; s < SIGNALS; s++) {
+        kill(getpid(), SIGUSR2);
+        for (int i = 0; i < OPS; i++) {
+            int slot = rand_r(&seed) % LIVE;
+            tufree(live[slot]);
+            live[slot] = tumalloc(rand_r(&seed) % 16 ? 16 + rand_r(&seed) % 512 : 8192 + rand_r(&seed) % 262144);
+        }
+    }
+    double elapsed = now() - start;
+
+    // The helper thread writes in the background, give it a moment to finish
+    off_t size = 0;
+    for (int i = 0; i < 100 && (size = report_size()) == 0; i++) {
+        usleep(10000);
+    }
+    usleep(100000);
+    size = report_size();
+    for (int i = 0; i < LIVE; i++) {
+        tufree(live[i]);
+    }
+
+    fprintf(stderr, "%.1f ns per pair with %d reports asked for\n", elapsed * 1e9 / ((double)OPS * SIGNALS), SIGNALS);
+    fprintf(stderr, "%s: %lld bytes\n", REPORT, (long long)size);
+    return size > 0 ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+#include "alloc.h"
+#include "scratch.h"
+
+#include <alloca.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Benchmark the scratch stack against alloca and tumalloc
+ *
+ * A recursive descent, like a parser or formatter, takes a buffer of
+ * varying size at every level, fills part of it and recurses. The buffer
+ * comes from alloca, from the scratch stack with a mark released on the
+ * way out, or from tumalloc/tufree.
+ */
+
+#define DEPTH 64 /**< Recursion depth of one descent */
+#define DESCENTS 100000 /**< Number of descents per run */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Descend with one buffer per level
+ *
+ * @param kind 0 for alloca, 1 for the scratch stack, 2 for tumalloc
+ * @param depth Levels left
+ * @param seed State for the buffer sizes
+ * @return A checksum of the buffers
+ */
+static unsigned descend(int kind, int depth, unsigned seed) {
+    if (depth == 0) {
+        return seed;
+    }
+    seed = seed * 1103515245u + 12345u;
+    size_t size = 16 + (seed >> 16) % 496;
+
+    void *mark = NULL;
+    char *buf;
+    if (kind == 0) {
+        buf = alloca(size);
+    } else if (kind == 1) {
+        mark = tuscratch_mark();
+        buf = tuscratch_alloc(size);
+    } else {
+        buf = tumalloc(size);
+    }
+    if (buf == NULL) {
+        fprintf(stderr, "allocation failed\n");
+        exit(1);
+    }
+
+    buf[0] = (char)depth;
+    buf[size - 1] = (char)seed;
+    unsigned sum = descend(kind, depth - 1, seed) + (unsigned char)buf[0] + (unsigned char)buf[size - 1];
+
+    if (kind == 1) {
+        tuscratch_release(mark);
+    } else if (kind == 2) {
+        tufree(buf);
+    }
+    return sum;
+}
+
+/**
+ * Time a run of descents
+ *
+ * @param kind 0 for alloca, 1 for the scratch stack, 2 for tumalloc
+ * @param sum Set to the checksum of all descents
+ * @return The time per allocation in ns
+ */
+static double run(int kind, unsigned *sum) {
+    *sum = 0;
+    double start = now();
+    for (unsigned i = 0; i < DESCENTS; i++) {
+        *sum += descend(kind, DEPTH, i);
+    }
+    return (now() - start) * 1e9 / ((double)DESCENTS * DEPTH);
+}
+
+int main(void) {
+    unsigned sums[3];
+    double stack = run(0, &sums[0]);
+    double scratch = run(1, &sums[1]);
+    double heap = run(2, &sums[2]);
+
+    // A scratch stack that hits its limit fails instead of overflowing
+    tuscratch_set_limit(1024 * 1024);
+    void *mark = tuscratch_mark();
+    int failed = tuscratch_alloc(2 * 1024 * 1024) == NULL;
+    tuscratch_release(mark);
+
+    fprintf(stderr, "alloca:          %6.1f ns/alloc\n", stack);
+    fprintf(stderr, "tuscratch:       %6.1f ns/alloc\n", scratch);
+    fprintf(stderr, "tumalloc/tufree: %6.1f ns/alloc\n", heap);
+    if (sums[0] != sums[1] || sums[0] != sums[2] || !failed) {
+        fprintf(stderr, "checks failed\n");
+        return 1;
+    }
+    return 0;
+}
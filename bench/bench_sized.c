@@ -0,0 +1,221 @@
+#include "alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/**
+ * Benchmark freeing cold objects with tufree and tufree_sized
+ *
+ * Allocates many small objects, shuffles them, evicts them from the CPU
+ * caches by streaming through a large buffer, and then times freeing all
+ * of them. Every run is a fresh forked child, and the two variants take
+ * turns going first, so neither gains from running second. Then checks
+ * that small blocks are carved at exactly their class, that tufree_sized
+ * keeps the statistics exact, and that it leaves blocks of another arena
+ * out of the thread cache, and exits with 1 if not.
+ */
+
+#define OBJECTS 1000000 /**< Number of objects freed per run */
+#define OBJECT_SIZE 64 /**< Size of every object */
+#define EVICT_BYTES (64 * 1024 * 1024) /**< Size of the buffer streamed to evict the caches */
+#define CACHED_MAX 512 /**< Largest block the thread caches hold */
+#define UNSPLIT (CACHED_MAX + 16) /**< A block one alignment step too small to split for CACHED_MAX */
+#define ROUNDS 6 /**< Runs of each variant */
+
+static void *objects[OBJECTS]; /**< The objects, in shuffled order */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Allocate and shuffle the objects, then evict them from the caches
+ *
+ * @param evict The buffer to stream through
+ */
+static void prepare(char *evict) {
+    for (int i = 0; i < OBJECTS; i++) {
+        objects[i] = tumalloc(OBJECT_SIZE);
+    }
+    unsigned seed = 1;
+    for (int i = OBJECTS - 1; i > 0; i--) {
+        int j = rand_r(&seed) % (i + 1);
+        void *tmp = objects[i];
+        objects[i] = objects[j];
+        objects[j] = tmp;
+    }
+    memset(evict, 1, EVICT_BYTES);
+}
+
+/**
+ * Free all objects with one of the variants in a fresh process
+ *
+ * @param sized Free with tufree_sized instead of tufree
+ * @return The time per free in ns
+ */
+static double time_frees(int sized) {
+    char *evict = malloc(EVICT_BYTES);
+    prepare(evict);
+    double start = now();
+    if (sized) {
+        for (int i = 0; i < OBJECTS; i++) {
+            tufree_sized(objects[i], OBJECT_SIZE);
+        }
+    } else {
+        for (int i = 0; i < OBJECTS; i++) {
+            tufree(objects[i]);
+        }
+    }
+    double elapsed = now() - start;
+    free(evict);
+    return elapsed * 1e9 / OBJECTS;
+}
+
+/**
+ * Check that small blocks are exact and tufree_sized keeps the statistics exact
+ *
+ * @return The number of failed checks
+ */
+static int check_exact(void) {
+    int failed = 0;
+
+    // The freed UNSPLIT block must not be handed out whole for a CACHED_MAX request
+    void *big = tumalloc(UNSPLIT);
+    void *guard = tumalloc(OBJECT_SIZE);
+    tufree(big);
+    void *unsplit = tumalloc(CACHED_MAX);
+    size_t usable = tumalloc_usable_size(unsplit);
+    if (usable != CACHED_MAX) {
+        fprintf(stderr, "tumalloc(%d) handed out a %zu-byte block\n", CACHED_MAX, usable);
+        failed++;
+    }
+    tustats before, after;
+    tumalloc_stats(&before);
+    tufree_sized(unsplit, CACHED_MAX);
+    tumalloc_stats(&after);
+    if (after.allocated != before.allocated - usable || after.nfree != before.nfree + 1) {
+        fprintf(stderr, "tufree_sized of a %zu-byte block as %d bytes: allocated %zu -> %zu\n", usable, CACHED_MAX,
+                before.allocated, after.allocated);
+        failed++;
+    }
+    for (int i = 0; i < TUSTATS_SMALL_CLASSES; i++) {
+        if (after.small_live[i] > before.small_live[i]) {
+            fprintf(stderr, "tufree_sized: small_live[%d] went from %zu to %zu\n", i, before.small_live[i],
+                    after.small_live[i]);
+            failed++;
+        }
+    }
+    tufree(guard);
+
+    // Shrinking in place to a small size leaves a block of exactly that class
+    tumalloc_stats(&before);
+    char *shrunk = turealloc(tumalloc(CACHED_MAX * 2), CACHED_MAX / 2 - 1);
+    if (tumalloc_usable_size(shrunk) != CACHED_MAX / 2) {
+        fprintf(stderr, "turealloc to %d left a %zu-byte block\n", CACHED_MAX / 2 - 1, tumalloc_usable_size(shrunk));
+        failed++;
+    }
+    tufree_sized(shrunk, CACHED_MAX / 2 - 1);
+    tumalloc_stats(&after);
+    if (after.allocated != before.allocated) {
+        fprintf(stderr, "tufree_sized after turealloc: allocated %zu -> %zu\n", before.allocated, after.allocated);
+        failed++;
+    }
+    return failed;
+}
+
+/**
+ * Check that tufree_sized leaves blocks of another arena out of the thread cache
+ *
+ * Needs TUMALLOC_CONF=arenas:2.
+ *
+ * @return The number of failed checks
+ */
+static int check_arenas(void) {
+    int failed = 0;
+
+    // A block of arena 1 freed by a thread of arena 0 goes back to arena 1
+    void *other = tumallocx(OBJECT_SIZE, TUMALLOCX_ARENA(1));
+    tufree_sized(other, OBJECT_SIZE);
+    void *mine = tumalloc(OBJECT_SIZE);
+    if (mine == other) {
+        fprintf(stderr, "tufree_sized put a block of arena 1 in the cache of an arena 0 thread\n");
+        failed++;
+    }
+    tufree(mine);
+    return failed;
+}
+
+/**
+ * Run a check in a fresh child process
+ *
+ * @param conf The TUMALLOC_CONF value for the child, or NULL to leave it unset
+ * @param check The check, returning its number of failed checks
+ * @return The number of failed checks, 1 if the child did not exit normally
+ */
+static int in_child(const char *conf, int (*check)(void)) {
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (conf) {
+            setenv("TUMALLOC_CONF", conf, 1);
+        }
+        int failed = check();
+        fflush(NULL);
+        _exit(failed < 255 ? failed : 255);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+        return 1;
+    }
+    return WEXITSTATUS(status);
+}
+
+int main(void) {
+    double *ns = mmap(NULL, 2 * ROUNDS * sizeof(double), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ns == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    // Every other round the sized variant goes first
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int turn = 0; turn < 2; turn++) {
+            int sized = turn ^ (round & 1);
+            fflush(NULL);
+            pid_t pid = fork();
+            if (pid == 0) {
+                ns[sized * ROUNDS + round] = time_frees(sized);
+                _exit(0);
+            }
+            waitpid(pid, NULL, 0);
+        }
+    }
+
+    const char *names[] = {"tufree:      ", "tufree_sized:"};
+    for (int sized = 0; sized < 2; sized++) {
+        double sum = 0, best = ns[sized * ROUNDS];
+        for (int round = 0; round < ROUNDS; round++) {
+            double t = ns[sized * ROUNDS + round];
+            sum += t;
+            best = t < best ? t : best;
+        }
+        fprintf(stderr, "%s %6.1f ns/free mean, %6.1f best of %d\n", names[sized], sum / ROUNDS, best, ROUNDS);
+    }
+    munmap(ns, 2 * ROUNDS * sizeof(double));
+
+    int failed = in_child(NULL, check_exact) + in_child("arenas:2", check_arenas);
+    fprintf(stderr, "sized frees: %d failed checks\n", failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,76 @@
+#include "alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/**
+ * Measure the cost of loading TUMALLOC_CONF on the first allocation
+ *
+ * Each configuration runs in its own forked child, so TUMALLOC_CONF is
+ * read by a process that has not allocated yet. The first tumalloc call is
+ * timed on its own and compared with the average of the calls after it.
+ */
+
+#define CALLS 10000 /**< Number of calls averaged after the first one */
+#define SIZE 64 /**< Size of every request */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Time the first and the following allocations with a configuration
+ *
+ * @param conf The TUMALLOC_CONF value, or NULL to leave it unset
+ */
+static void run(const char *conf) {
+    if (conf) {
+        setenv("TUMALLOC_CONF", conf, 1);
+    } else {
+        unsetenv("TUMALLOC_CONF");
+    }
+
+    double start = now();
+    void *first = tumalloc(SIZE);
+    double first_time = now() - start;
+
+    start = now();
+    for (int i = 0; i < CALLS; i++) {
+        tufree(tumalloc(SIZE));
+    }
+    double rest_time = (now() - start) / CALLS;
+    tufree(first);
+
+    size_t threshold, arenas;
+    size_t len = sizeof(size_t);
+    tumallctl("opt.mmap_threshold", &threshold, &len, NULL, 0);
+    tumallctl("opt.arenas", &arenas, &len, NULL, 0);
+
+    fprintf(stderr, "%-52s first call %7.2f us  later calls %6.2f us  (threshold %zu KiB, %zu arenas)\n",
+            conf ? conf : "unset", first_time * 1e6, rest_time * 1e6, threshold / 1024, arenas);
+}
+
+int main(void) {
+    const char *confs[] = {NULL, "mmap_threshold:256k,decay_ms:5000", "arenas:8,mmap_threshold:256k,decay_ms:5000,fit:best"};
+    for (size_t i = 0; i < sizeof(confs) / sizeof(confs[0]); i++) {
+        fflush(NULL);
+        pid_t pid = fork();
+        if (pid == 0) {
+            run(confs[i]);
+            fflush(NULL);
+            _exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
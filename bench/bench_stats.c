@@ -0,0 +1,114 @@
+#include "alloc.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Benchmark the allocation statistics
+ *
+ * Runs THREADS threads that each allocate and free OPS small, medium and
+ * large blocks, every other one with tufree_sized at the size asked for,
+ * then checks that the counters add up once they are done:
+ * every tumalloc matched by a tufree, allocated and active back at their
+ * starting values, and no small blocks left live. Also times
+ * tumalloc_stats, which sums every thread's counters.
+ */
+
+#define THREADS 4 /**< Number of allocating threads */
+#define OPS 200000 /**< Allocations per thread */
+#define LIVE 256 /**< Blocks each thread keeps live at a time */
+#define READS 100000 /**< Calls to tumalloc_stats to time */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Allocate and free a mix of block sizes
+ *
+ * @param arg The thread number
+ * @return NULL
+ */
+static void *churn(void *arg) {
+    void *live[LIVE] = {0};
+    size_t asked[LIVE] = {0};
+    unsigned seed = (unsigned)(size_t)arg + 1;
+    for (int i = 0; i < OPS; i++) {
+        int slot = rand_r(&seed) % LIVE;
+        if (i % 2) {
+            tufree_sized(live[slot], asked[slot]);
+        } else {
+            tufree(live[slot]);
+        }
+        size_t size;
+        switch (rand_r(&seed) % 16) {
+        case 0:
+            size = 200000;  // mapped
+            break;
+        case 1:
+        case 2:
+            size = 600 + rand_r(&seed) % 4000;
+            break;
+        default:
+            size = 1 + rand_r(&seed) % 512;
+            break;
+        }
+        live[slot] = tumalloc(size);
+        if (i % 64 == 0) {
+            size *= 2;
+            live[slot] = turealloc(live[slot], size);
+        }
+        asked[slot] = size;
+    }
+    for (int i = 0; i < LIVE; i++) {
+        tufree(live[i]);
+    }
+    return NULL;
+}
+
+int main(void) {
+    tustats before, after;
+    tumalloc_stats(&before);
+
+    pthread_t threads[THREADS];
+    double start = now();
+    for (int i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, churn, (void *)(size_t)i);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double churn_time = now() - start;
+
+    start = now();
+    for (int i = 0; i < READS; i++) {
+        tumalloc_stats(&after);
+    }
+    double read_time = now() - start;
+
+    size_t small_live = 0;
+    for (int i = 0; i < TUSTATS_SMALL_CLASSES; i++) {
+        small_live += after.small_live[i];
+    }
+    int ok = after.nmalloc - before.nmalloc == after.nfree - before.nfree &&
+             after.allocated == before.allocated && after.active == before.active && small_live == 0 &&
+             after.mapped >= after.active;
+
+    fprintf(stderr, "%d threads x %d ops: %.1f ms\n", THREADS, OPS, churn_time * 1e3);
+    fprintf(stderr, "nmalloc %zu  nfree %zu  nrealloc %zu  tcache hits %zu  misses %zu\n", after.nmalloc,
+            after.nfree, after.nrealloc, after.tcache_hits, after.tcache_misses);
+    fprintf(stderr, "allocated %zu  active %zu  mapped %zu  retained %zu\n", after.allocated, after.active,
+            after.mapped, after.retained);
+    fprintf(stderr, "tumalloc_stats: %.0f ns per call\n", read_time / READS * 1e9);
+    fprintf(stderr, "counters %s\n", ok ? "consistent" : "INCONSISTENT");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,63 @@
+#include "alloc.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Measure what event tracing costs tumalloc and tufree
+ *
+ * Churns small and medium blocks through tumalloc and tufree and reports
+ * the time per pair, then dumps the trace rings to TRACE_FILE. Build once
+ * with -DTUMALLOC_TRACE=ON and once without and compare the two: without
+ * it the dump fails and the calls carry no tracing code at all. The dump
+ * can be read with `tutrace /tmp/bench_trace.bin`.
+ */
+
+#define OPS 2000000 /**< tumalloc/tufree pairs per run */
+#define LIVE 1024 /**< Blocks kept live */
+#define ROUNDS 3 /**< Runs, the fastest is reported */
+#define TRACE_FILE "/tmp/bench_trace.bin" /**< Where the trace is dumped */
+
+static void *live[LIVE]; /**< The live blocks */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void) {
+    unsigned seed = 1;
+    double best = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+        double start = now();
+        for (int i = 0; i < OPS; i++) {
+            int slot = rand_r(&seed) % LIVE;
+            tufree(live[slot]);
+            live[slot] = tumalloc(rand_r(&seed) % 8 ? 16 + rand_r(&seed) % 256 : 1024 + rand_r(&seed) % 4096);
+        }
+        double ns = (now() - start) * 1e9 / OPS;
+        if (r == 0 || ns < best) {
+            best = ns;
+        }
+    }
+    for (int i = 0; i < LIVE; i++) {
+        tufree(live[i]);
+    }
+
+    fprintf(stderr, "tufree + tumalloc: %.1f ns per pair\n", best);
+    if (tumalloc_trace_dump(TRACE_FILE) == 0) {
+        fprintf(stderr, "trace written to %s\n", TRACE_FILE);
+    } else {
+        fprintf(stderr, "no trace written: %s\n", strerror(errno));
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include "alloc.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Count the reallocations of a growing vector with and without usable sizes
+ *
+ * The vector grows its capacity by half whenever it is full. The naive
+ * variant only knows the capacity it asked for, the other one adopts the
+ * usable size reported by tumalloc_at_least and tumalloc_usable_size, and
+ * asks for tumalloc_good_size amounts. Then tumalloc_good_size is checked
+ * to be its own good size across the small, medium and mapped ranges, and
+ * mapped blocks of a good size to be exactly that large, up to sizes that
+ * cannot be rounded up at all. Requests too large
+ * to round up must fail with ENOMEM and leave a reallocated block alone.
+ */
+
+#define VECTORS 1000 /**< Number of vectors built per run */
+#define ELEMENTS 20000 /**< Number of bytes appended to every vector */
+#define CHECK_MAX (8 * 1024 * 1024) /**< Largest size tumalloc_good_size is checked on */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Build vectors byte by byte and count the reallocations
+ *
+ * @param usable Use the usable size of every block
+ * @return The number of turealloc calls
+ */
+static long build(int usable) {
+    long reallocs = 0;
+    for (int v = 0; v < VECTORS; v++) {
+        size_t len = 0;
+        size_t cap = 0;
+        char *data = usable ? tumalloc_at_least(1, &cap) : tumalloc(cap = 1);
+        for (int i = 0; i < ELEMENTS; i++) {
+            if (len == cap) {
+                size_t want = cap + cap / 2 + 1;
+                data = turealloc(data, usable ? tumalloc_good_size(want) : want);
+                cap = usable ? tumalloc_usable_size(data) : want;
+                reallocs++;
+            }
+            data[len++] = (char)i;
+        }
+        tufree(data);
+    }
+    return reallocs;
+}
+
+/**
+ * Check that good sizes are fixed points
+ *
+ * @return The number of sizes that failed
+ */
+static int check_good_sizes(void) {
+    size_t threshold;
+    size_t len = sizeof(threshold);
+    tumallctl("opt.mmap_threshold", &threshold, &len, NULL, 0);
+
+    int failed = 0;
+    for (size_t n = 1; n <= CHECK_MAX; n += n < 4096 ? 1 : n / 64 + 7) {
+        size_t good = tumalloc_good_size(n);
+        if (good < n || tumalloc_good_size(good) != good) {
+            fprintf(stderr, "good_size(%zu) = %zu, good_size of that = %zu\n", n, good, tumalloc_good_size(good));
+            failed++;
+        }
+        if (good >= threshold) {
+            void *p = tumalloc(good);
+            if (tumalloc_usable_size(p) != good) {
+                fprintf(stderr, "tumalloc(%zu) has %zu usable bytes\n", good, tumalloc_usable_size(p));
+                failed++;
+            }
+            tufree(p);
+        }
+    }
+
+    // Sizes too large to round up are their own good size
+    size_t huge[] = {SIZE_MAX, SIZE_MAX - 1, SIZE_MAX - 5000, SIZE_MAX / 2 + 1, SIZE_MAX / 2, SIZE_MAX / 2 - 1};
+    for (size_t i = 0; i < sizeof(huge) / sizeof(huge[0]); i++) {
+        size_t good = tumalloc_good_size(huge[i]);
+        if (good < huge[i] || tumalloc_good_size(good) != good) {
+            fprintf(stderr, "good_size(%zu) = %zu, good_size of that = %zu\n", huge[i], good, tumalloc_good_size(good));
+            failed++;
+        }
+    }
+    return failed;
+}
+
+/**
+ * Check that requests whose rounding would wrap around fail
+ *
+ * @return The number of failed checks
+ */
+static int check_overflow(void) {
+    int failed = 0;
+    size_t sizes[] = {SIZE_MAX, SIZE_MAX - 5000, SIZE_MAX / 2 + 1};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        errno = 0;
+        void *ptr = tumalloc(sizes[i]);
+        if (ptr != NULL || errno != ENOMEM) {
+            fprintf(stderr, "tumalloc(%zu) gave %p with %zu usable bytes\n", sizes[i], ptr, tumalloc_usable_size(ptr));
+            failed++;
+        }
+    }
+
+    char *block = tumalloc(100);
+    memset(block, 7, 100);
+    errno = 0;
+    if (turealloc(block, SIZE_MAX) != NULL || errno != ENOMEM || block[99] != 7) {
+        fprintf(stderr, "turealloc(%p, SIZE_MAX) did not fail cleanly\n", (void *)block);
+        failed++;
+    }
+    tufree(block);
+    return failed;
+}
+
+int main(void) {
+    double start = now();
+    long naive = build(0);
+    double naive_time = now() - start;
+
+    start = now();
+    long usable = build(1);
+    double usable_time = now() - start;
+
+    fprintf(stderr, "requested capacity: %7ld reallocs  %7.1f ms\n", naive, naive_time * 1e3);
+    fprintf(stderr, "usable capacity:    %7ld reallocs  %7.1f ms\n", usable, usable_time * 1e3);
+
+    int failed = check_good_sizes() + check_overflow();
+    fprintf(stderr, "size checks: %d failed checks\n", failed);
+    return failed ? 1 : 0;
+}
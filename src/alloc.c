@@ -1,13 +1,256 @@
+#define _GNU_SOURCE /**< For mremap */
+
 #include "alloc.h"
+#include "ctl.h"
+#include "export.h"
+#include "pressure.h"
+#include "probes.h"
+#include "prof.h"
+#include "report.h"
+#include "trace.h"
+#include <errno.h>
+#include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #define ALIGNMENT 16 /**< The alignment of the memory blocks */
 
-static free_block *HEAD = NULL; /**< Pointer to the first element of the free list */
+#define MMAP_THRESHOLD (128 * 1024) /**< Default for opt.mmap_threshold: requests this large or larger get their own mapping */
+#define LARGE_CACHE_SLOTS 32 /**< Maximum number of released mappings kept for reuse */
+#define LARGE_CACHE_MAX_BYTES (64 * 1024 * 1024) /**< Default for opt.large_cache_max_bytes: bytes kept in the mapping cache */
+#define LARGE_CACHE_DECAY_MS 10000 /**< Default for opt.large_cache_decay_ms: older cached mappings are returned to the OS */
+#define PURGE_LEVEL 2 /**< Default for opt.purge_level: pressure level from which free heap pages are returned to the OS */
+
+#define SMALL_MAX 512 /**< Largest request served from the size-class bins */
+#define SMALL_CLASSES (SMALL_MAX / ALIGNMENT) /**< Number of size-class bins, one per ALIGNMENT step */
+#define ALIGN_LEVELS 4 /**< Bins keep separate lists for payloads aligned to 16, 32, 64 and 128 or more */
+#define PREWARM_THREADS 4 /**< Maximum number of threads pre-faulting a reservation */
+
+#define MAX_ARENAS 64 /**< Maximum number of arenas, including the main heap */
+#define LOCKED_CHUNK (4 * 1024 * 1024) /**< Minimum size of the chunks a locked arena maps when it grows */
+#define ZERO_SPANS 16 /**< Purged ranges an arena remembers as known to be zero */
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23 /**< Linux 5.14+, missing from older headers */
+#endif
+
+#define MAGIC_HEAP 0x74756800 /**< Magic number of blocks carved from an arena, the low byte holds the arena index */
+#define MAGIC_ARENA_MASK 0xff /**< Bits of the magic number holding the arena index */
+#define MAGIC_MMAP 0x74756d70 /**< Magic number of blocks backed by their own mapping */
+
+#define LOG_SUB_BITS 2 /**< Histogram buckets split each power of two into 1 << LOG_SUB_BITS steps */
+#define LAT_BUCKETS 128 /**< Latency buckets per histogram, the last one covers 2^33 ns and up */
+#define FRAG_BUCKETS 192 /**< Free block size buckets per arena, enough for any 48-bit size */
+
+_Static_assert(sizeof(header) == sizeof(free_block), "allocated and free headers must overlay");
+
+/**
+ * Free blocks of one size class, split by the alignment of their payload
+ *
+ * Aligned requests take from the list of their alignment or a stricter
+ * one, plain requests from the least aligned list that is not empty, so
+ * well-aligned blocks are kept for the requests that need them.
+ */
+typedef struct size_bin {
+    free_block *lists[ALIGN_LEVELS]; /**< Free blocks by alignment level, from 16 bytes up */
+    unsigned mask; /**< Bit i is set when lists[i] is not empty */
+} size_bin;
+_Static_assert(MAX_ARENAS <= MAGIC_ARENA_MASK + 1, "arena index must fit in the magic number");
+
+/**
+ * A heap with its own free lists and lock
+ *
+ * Arena 0 is the main heap grown with sbrk, as are the arenas TUMALLOC_CONF
+ * asks for, which come right after it. Locked arenas grow by mapping
+ * chunks pinned with mlock and keep all of their memory until exit.
+ */
+typedef struct arena {
+    pthread_mutex_t lock; /**< Protects all other fields */
+    free_block *head; /**< Pointer to the first element of the free list */
+    free_block *next_fit; /**< Where the next-fit search starts (extra cred) */
+    size_bin bins[SMALL_CLASSES]; /**< Free blocks of exactly one size class each, by class index */
+    int locked; /**< Memory is pinned, never purged, and serves large requests too */
+    size_t locked_bytes; /**< Bytes pinned in memory */
+    size_t unpinned_bytes; /**< Bytes of a locked arena that could not be pinned */
+    uintptr_t zero_lo[ZERO_SPANS]; /**< Starts of purged ranges inside free blocks, still zero */
+    uintptr_t zero_hi[ZERO_SPANS]; /**< Ends of the purged ranges */
+    unsigned zero_spans; /**< Number of purged ranges */
+    uintptr_t last_zero_lo; /**< Start of the known-zero part of the block arena_alloc returned last */
+    uintptr_t last_zero_hi; /**< End of that part, equal to last_zero_lo if nothing is known */
+    size_t search_depth[TUSTATS_SEARCH_BUCKETS]; /**< Free-list searches by blocks visited, see search_bucket */
+    size_t search_visited; /**< Blocks visited by all free-list searches */
+    size_t search_hits; /**< Searches that found a block */
+    size_t search_misses; /**< Searches that found none, so the arena grew */
+    size_t fit_wasted_bytes; /**< Bytes handed out beyond the request because the block was too small to split */
+    size_t footprint; /**< Bytes the arena got from sbrk or mmap */
+    size_t free_bytes; /**< Payload bytes of the blocks on the free list and in the bins */
+    size_t free_blocks; /**< Number of those blocks */
+    size_t free_hist[FRAG_BUCKETS]; /**< Those blocks by size, see log_bucket */
+} arena;
+
+static arena arenas[MAX_ARENAS] = {{.lock = PTHREAD_MUTEX_INITIALIZER}}; /**< All arenas, the main heap first */
+static _Atomic unsigned narenas = 1; /**< Number of initialized arenas, read without the lock by tufree_sized */
+static pthread_mutex_t arenas_lock = PTHREAD_MUTEX_INITIALIZER; /**< Protects arena creation */
+static pthread_mutex_t sbrk_lock = PTHREAD_MUTEX_INITIALIZER; /**< Serializes sbrk calls of the arenas sharing the break */
+static _Thread_local unsigned thread_arena = 0; /**< Index of the arena the calling thread allocates from */
+
+/**
+ * Free small blocks a thread keeps for itself, without taking a lock
+ *
+ * The blocks are held by pointer, so caching or reusing one touches no
+ * block memory. They all belong to the thread's arena and still carry a
+ * valid allocated header.
+ */
+typedef struct tcache {
+    unsigned count[SMALL_CLASSES]; /**< Number of cached blocks per size class */
+    free_block *slots[SMALL_CLASSES][TCACHE_SLOTS]; /**< Cached blocks per size class, newest last */
+    int registered; /**< Whether the thread exit flush is set up */
+} tcache;
+
+static _Thread_local tcache thread_cache; /**< The calling thread's cache */
+static pthread_key_t tcache_key; /**< Runs tcache_exit when a thread with a cache exits */
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT; /**< Creates tcache_key */
+
+/**
+ * Statistics counters of one thread
+ *
+ * Only the owning thread updates them, with plain relaxed loads and
+ * stores, so counting costs no more than an increment. Readers add up all
+ * shards. Byte and live counts can go below zero in a shard that frees
+ * blocks another thread allocated, only the sum is meaningful.
+ */
+typedef struct stats_shard {
+    _Atomic size_t allocated; /**< Usable bytes of blocks allocated minus those freed */
+    _Atomic size_t active; /**< The same including headers, whole mappings for mapped blocks */
+    _Atomic size_t nmalloc; /**< Blocks allocated */
+    _Atomic size_t nfree; /**< Blocks freed */
+    _Atomic size_t nrealloc; /**< Reallocation calls */
+    _Atomic size_t tcache_hits; /**< Small allocations served by the thread cache */
+    _Atomic size_t tcache_misses; /**< Small allocations that had to take the arena lock */
+    _Atomic size_t small_live[SMALL_CLASSES]; /**< Small blocks allocated minus those freed, by size class */
+    _Atomic size_t large_live[TUSTATS_LARGE_BUCKETS]; /**< Larger blocks allocated minus those freed, by size bucket */
+    _Atomic size_t large_live_bytes[TUSTATS_LARGE_BUCKETS]; /**< Their usable bytes */
+    _Atomic size_t arena_allocated[MAX_ARENAS]; /**< Usable bytes of arena blocks allocated minus those freed, by arena */
+    _Atomic size_t arena_live[MAX_ARENAS]; /**< Arena blocks allocated minus those freed, by arena */
+    _Atomic size_t arena_slack[MAX_ARENAS]; /**< Their usable bytes beyond the request, by arena */
+#ifdef TUMALLOC_LATENCY
+    _Atomic size_t lat[TULAT_OPS][TULAT_SIZES][LAT_BUCKETS]; /**< Latency histograms by operation and size group */
+    _Atomic size_t lat_max[TULAT_OPS][TULAT_SIZES]; /**< Slowest call by operation and size group, in ns */
+#endif
+    struct stats_shard *next; /**< The next shard of a live thread */
+} stats_shard;
+
+_Static_assert(SMALL_CLASSES == TUSTATS_SMALL_CLASSES, "tustats must have one live count per size class");
+
+#define STAT_ADD(counter, n) atomic_store_explicit(&(counter), \
+    atomic_load_explicit(&(counter), memory_order_relaxed) + (size_t)(n), memory_order_relaxed) /**< Add to a counter only its thread updates */
+
+static _Thread_local stats_shard thread_stats; /**< The calling thread's counters */
+static stats_shard *stats_shards = NULL; /**< Shards of all live threads that allocated or freed */
+static stats_shard stats_retired; /**< Sum of the shards of exited threads */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER; /**< Protects stats_shards and stats_retired */
+static pthread_key_t stats_key; /**< Runs stats_exit when a thread with a shard exits */
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT; /**< Creates stats_key */
+static _Atomic size_t mapped_bytes = 0; /**< Bytes obtained with sbrk and mmap and not unmapped */
+
+static _Thread_local int thread_ready = 0; /**< Whether thread_init has run on the calling thread */
+static pthread_once_t conf_once = PTHREAD_ONCE_INIT; /**< Runs conf_load */
+static _Atomic unsigned arena_next = 0; /**< Round-robin counter spreading threads over the configured arenas */
+
+static pthread_mutex_t large_lock = PTHREAD_MUTEX_INITIALIZER; /**< Protects the mapping cache and its counters */
+
+/**
+ * A released large mapping waiting to be reused
+ */
+typedef struct cached_mapping {
+    void *base; /**< Start of the mapping */
+    size_t len; /**< Length of the mapping, always a large size class */
+    uint64_t freed_at; /**< Monotonic time in ns at which the mapping was released */
+} cached_mapping;
+
+static cached_mapping large_cache[LARGE_CACHE_SLOTS]; /**< Cached mappings, oldest first */
+static size_t large_cache_count = 0; /**< Number of used slots in large_cache */
+static size_t large_cache_bytes = 0; /**< Total length of all cached mappings */
+static size_t large_cache_hits = 0; /**< Large allocations served from the cache */
+static size_t large_cache_misses = 0; /**< Large allocations that needed a new mapping */
+static _Atomic size_t realloc_remaps = 0; /**< Reallocations done by remapping pages */
+static _Atomic size_t realloc_bytes_copied = 0; /**< Payload bytes copied by turealloc */
+static int pressure = 0; /**< Memory pressure level the caches are currently sized for, under large_lock */
+static _Atomic size_t purged_bytes = 0; /**< Free heap bytes returned to the OS with MADV_DONTNEED */
+static _Atomic size_t calloc_bytes_skipped = 0; /**< Bytes tucalloc did not clear because they were known to be zero */
+
+_Atomic size_t opt_mmap_threshold = MMAP_THRESHOLD; /**< Requests this large or larger get their own mapping */
+_Atomic size_t opt_large_cache_max_bytes = LARGE_CACHE_MAX_BYTES; /**< Bytes kept in the mapping cache without pressure */
+_Atomic size_t opt_large_cache_decay_ms = LARGE_CACHE_DECAY_MS; /**< Age at which cached mappings are returned without pressure */
+_Atomic size_t opt_tcache_slots = TCACHE_SLOTS; /**< Blocks a thread caches per size class before flushing half */
+_Atomic size_t opt_purge_level = PURGE_LEVEL; /**< Pressure level from which free heap pages are purged */
+_Atomic int opt_fit = FIT_NEXT; /**< Free-list search policy, one of the FIT_* values */
+_Atomic size_t opt_arenas = 1; /**< Number of heap arenas threads are spread over, fixed by TUMALLOC_CONF */
+
+/**
+ * Get the histogram bucket of a value
+ *
+ * Buckets are exact below 1 << LOG_SUB_BITS, then every power of two is
+ * split into 1 << LOG_SUB_BITS equal steps, so a bucket is never wider
+ * than a quarter of the values in it.
+ *
+ * @param value The value, such as a duration or a block size
+ * @return The bucket index, which callers cap to their histogram size
+ */
+static int log_bucket(uint64_t value) {
+    if (value < (1u << LOG_SUB_BITS)) {
+        return (int)value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    return ((msb - LOG_SUB_BITS + 1) << LOG_SUB_BITS) +
+           (int)((value >> (msb - LOG_SUB_BITS)) & ((1u << LOG_SUB_BITS) - 1));
+}
+
+/**
+ * Get the largest value that falls into a histogram bucket
+ *
+ * @param i The bucket index
+ * @return The upper bound of the bucket
+ */
+static uint64_t log_bucket_max(int i) {
+    if (i < (1 << LOG_SUB_BITS)) {
+        return (uint64_t)i;
+    }
+    int shift = (i >> LOG_SUB_BITS) - 1;
+    uint64_t lo = ((uint64_t)(1u << LOG_SUB_BITS) + (i & ((1u << LOG_SUB_BITS) - 1))) << shift;
+    return lo + ((uint64_t)1 << shift) - 1;
+}
+
+/**
+ * Count a block joining an arena's free list or bins
+ *
+ * @param a The arena, locked by the caller
+ * @param block The block, with its final size
+ */
+static void free_add(arena *a, free_block *block) {
+    a->free_bytes += block->size;
+    a->free_blocks++;
+    a->free_hist[log_bucket(block->size)]++;
+}
+
+/**
+ * Count a block leaving an arena's free list or bins
+ *
+ * @param a The arena, locked by the caller
+ * @param block The block, with the size it was counted at
+ */
+static void free_sub(arena *a, free_block *block) {
+    a->free_bytes -= block->size;
+    a->free_blocks--;
+    a->free_hist[log_bucket(block->size)]--;
+}
 
 /**
  * Split a free block into two blocks
@@ -28,6 +271,7 @@ void *split(free_block *block, int size) {
     new_block->next = block->next;
 
     block->size = size;
+    block->next = new_block;
 
     return block;
 }
@@ -35,11 +279,12 @@ void *split(free_block *block, int size) {
 /**
  * Find the previous neighbor of a block
  *
+ * @param a The arena whose free list to search
  * @param block The block to find the previous neighbor of
  * @return A pointer to the previous neighbor or NULL if there is none
  */
-free_block *find_prev(free_block *block) {
-    free_block *curr = HEAD;
+free_block *find_prev(arena *a, free_block *block) {
+    free_block *curr = a->head;
     while(curr != NULL) {
         char *next = (char *)curr + curr->size + sizeof(free_block);
         if(next == (char *)block)
@@ -52,12 +297,13 @@ free_block *find_prev(free_block *block) {
 /**
  * Find the next neighbor of a block
  *
+ * @param a The arena whose free list to search
  * @param block The block to find the next neighbor of
  * @return A pointer to the next neighbor or NULL if there is none
  */
-free_block *find_next(free_block *block) {
+free_block *find_next(arena *a, free_block *block) {
     char *block_end = (char*)block + block->size + sizeof(free_block);
-    free_block *curr = HEAD;
+    free_block *curr = a->head;
 
     while(curr != NULL) {
         if((char *)curr == block_end)
@@ -70,12 +316,18 @@ free_block *find_next(free_block *block) {
 /**
  * Remove a block from the free list
  *
+ * @param a The arena whose free list holds the block
  * @param block The block to remove
  */
-void remove_free_block(free_block *block) {
-    free_block *curr = HEAD;
+void remove_free_block(arena *a, free_block *block) {
+    if (a->next_fit == block) {
+        a->next_fit = block->next;
+    }
+    free_sub(a, block);
+
+    free_block *curr = a->head;
     if(curr == block) {
-        HEAD = block->next;
+        a->head = block->next;
         return;
     }
     while(curr != NULL) {
@@ -90,42 +342,35 @@ void remove_free_block(free_block *block) {
 /**
  * Coalesce neighboring free blocks
  *
+ * Neighbors on the free list are unlinked and merged into the block, which
+ * is expected not to be on the free list itself.
+ *
+ * @param a The arena whose free list to merge from
  * @param block The block to coalesce
  * @return A pointer to the first block of the coalesced blocks
  */
-void *coalesce(free_block *block) {
+void *coalesce(arena *a, free_block *block) {
     if (block == NULL) {
         return NULL;
     }
 
-    free_block *prev = find_prev(block);
-    free_block *next = find_next(block);
-
     // Coalesce with previous block if it is contiguous.
+    free_block *prev = find_prev(a, block);
     if (prev != NULL) {
-        char *end_of_prev = (char *)prev + prev->size + sizeof(free_block);
-        if (end_of_prev == (char *)block) {
-            prev->size += block->size + sizeof(free_block);
-
-            // Ensure prev->next is updated to skip over 'block', only if 'block' is directly next to 'prev'.
-            if (prev->next == block) {
-                prev->next = block->next;
-            }
-            block = prev; // Update block to point to the new coalesced block.
-        }
+        remove_free_block(a, prev);
+        prev->size += block->size + sizeof(free_block);
+        block = prev; // Update block to point to the new coalesced block.
     }
 
     // Coalesce with next block if it is contiguous.
+    free_block *next = find_next(a, block);
     if (next != NULL) {
-        char *end_of_block = (char *)block + block->size + sizeof(free_block);
-        if (end_of_block == (char *)next) {
-            block->size += next->size + sizeof(free_block);
-
-            // Ensure block->next is updated to skip over 'next'.
-            block->next = next->next;
-        }
+        remove_free_block(a, next);
+        block->size += next->size + sizeof(free_block);
     }
 
+    PROBE3(coalesce, block + 1, block->size, (prev != NULL) + (next != NULL));
+
     return block;
 }
 
@@ -148,136 +393,2590 @@ void *do_alloc(size_t size) {
     return new_block;
 }
 
-//for extra cred: ptr to last allcated free blk
-static free_block *next_fit_ptr = NULL; 
 /**
- * Allocates memory for the end user
+ * Get the current monotonic time
  *
- * @param size The amount of memory to allocate
- * @return A pointer to the requested block of memory
+ * @return The time in nanoseconds
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Get the mapping cache byte bound for the current pressure level
+ *
+ * Each level halves the bound, and the highest level disables the cache.
+ *
+ * @return The maximum number of bytes the mapping cache may hold
  */
+static size_t large_cache_limit(void) {
+    return pressure >= PRESSURE_LEVELS - 1 ? 0 : opt_large_cache_max_bytes >> pressure;
+}
 
+/**
+ * Get the mapping cache decay time for the current pressure level
+ *
+ * @return The age in ns after which a cached mapping is returned to the OS
+ */
+static uint64_t large_cache_decay(void) {
+    return ((uint64_t)opt_large_cache_decay_ms * 1000000u) >> pressure;
+}
 
+/**
+ * Round a large request up to its size class
+ *
+ * Classes are spaced four per power of two, so a class never wastes more
+ * than a quarter of the request while similar sizes still share mappings.
+ *
+ * @param size The size, at least a page
+ * @return The size of the class
+ */
+static size_t large_class(size_t size) {
+    size_t lg = sizeof(size_t) * 8 - 1 - (size_t)__builtin_clzl(size);
+    size_t step = (size_t)1 << (lg - 2);
+    return (size + step - 1) & ~(step - 1);
+}
 
-void *tumalloc(size_t size) {
-    // Track and test extra cred Next fit print statements
-    printf("Requesting allocation of size: %zu\n", size);
-    printf("Next Fit pointer before allocation: %p\n", next_fit_ptr);
+/**
+ * Compute the length of the mapping backing a large request
+ *
+ * The classes are taken over the pages past the first, which also holds
+ * the header, so every mapping length is a class plus one page. Asking for
+ * the payload of a mapping, its length less the header, then gets a
+ * mapping of the same length back, and a power-of-two request only costs
+ * one extra page.
+ *
+ * @param size The aligned request size
+ * @return The mapping length, a multiple of the page size, or 0 if it would not fit in a size_t
+ */
+static size_t large_map_len(size_t size) {
+    if (size > SIZE_MAX / 2) {
+        return 0;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t len = (size + sizeof(header) + page - 1) & ~(page - 1);
+    return large_class(len - page) + page;
+}
 
-    // Align the size / rounding up to nearest block size
-    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1); 
+/**
+ * Remove the slot at index i from the mapping cache
+ *
+ * @param i The slot to remove
+ */
+static void large_cache_remove(size_t i) {
+    large_cache_bytes -= large_cache[i].len;
+    large_cache_count--;
+    memmove(&large_cache[i], &large_cache[i + 1], (large_cache_count - i) * sizeof(cached_mapping));
+}
 
+/**
+ * Unmap memory and stop counting it as mapped
+ *
+ * @param base The start of the range
+ * @param len The length of the range
+ */
+static void large_unmap(void *base, size_t len) {
+    PROBE2(unmap, base, len);
+    munmap(base, len);
+    mapped_bytes -= len;
+}
 
-    // next, start from next_fit_ptr (or the HEAD)
-    free_block *current = next_fit_ptr ? next_fit_ptr : HEAD;  
-    free_block *prev = NULL;
+/**
+ * Return cached mappings to the OS that are too old or over the byte bound
+ *
+ * @param now The current monotonic time in ns
+ */
+static void large_cache_expire(uint64_t now) {
+    while (large_cache_count > 0 &&
+           (now - large_cache[0].freed_at > large_cache_decay() || large_cache_bytes > large_cache_limit())) {
+        large_unmap(large_cache[0].base, large_cache[0].len);
+        large_cache_remove(0);
+    }
+}
 
-    // Traverse free list to find suitable block size
-    while (current) {
-        if (current->size >= size) {
-            // If necessary, split block
-            if (current->size > size + sizeof(free_block)) {
-                split(current, size);
-            }
+/**
+ * Get the number of arenas, including the main heap
+ *
+ * @return The number of arenas
+ */
+unsigned arena_count(void) {
+    pthread_mutex_lock(&arenas_lock);
+    unsigned count = narenas;
+    pthread_mutex_unlock(&arenas_lock);
+    return count;
+}
 
-            // Remove the block from the free list
-            if (prev) {
-                prev->next = current->next;
-            } else {
-                HEAD = current->next;
+/**
+ * Return the whole pages inside the free blocks of one arena to the OS
+ *
+ * The block headers stay in place, so the free lists are unaffected and the
+ * pages are faulted back in as zero pages when the blocks are reused. The
+ * purged ranges are remembered so tucalloc can skip clearing them. Locked
+ * arenas are never purged.
+ *
+ * @param index The arena index, below arena_count()
+ */
+void arena_purge(unsigned index) {
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    arena *a = &arenas[index];
+    pthread_mutex_lock(&a->lock);
+    for (free_block *curr = a->locked ? NULL : a->head; curr != NULL; curr = curr->next) {
+        uintptr_t start = ((uintptr_t)(curr + 1) + page - 1) & ~(page - 1);
+        uintptr_t end = ((uintptr_t)(curr + 1) + curr->size) & ~(page - 1);
+        if (end > start && madvise((void *)start, end - start, MADV_DONTNEED) == 0) {
+            purged_bytes += end - start;
+            if (a->zero_spans < ZERO_SPANS) {
+                a->zero_lo[a->zero_spans] = start;
+                a->zero_hi[a->zero_spans++] = end;
             }
+        }
+    }
+    pthread_mutex_unlock(&a->lock);
+}
+
+/**
+ * Return the whole pages inside free heap blocks of all arenas to the OS
+ */
+static void heap_purge(void) {
+    unsigned count = arena_count();
+    for (unsigned i = 0; i < count; i++) {
+        arena_purge(i);
+    }
+}
 
-            // Update the next_fit_ptr to the next free block
-            next_fit_ptr = current->next ? current->next : HEAD;  
+/**
+ * Adapt the caches to the current memory pressure
+ *
+ * Rereads the cgroup limit, usage and PSI at most every few milliseconds.
+ * As pressure rises the mapping cache shrinks and ages out faster, and on
+ * every change to a level of opt_purge_level or more, free heap pages are purged.
+ * Cached mappings past their age are unmapped on every call, so heap growth
+ * also ages out the cache of a process that stopped allocating large blocks.
+ *
+ * Must be called without any allocator lock held. If another thread is
+ * already updating, the call returns at once.
+ *
+ * @param now The current monotonic time in ns
+ * @param force Reread the pressure files even if the last read is recent
+ */
+static void pressure_update(uint64_t now, int force) {
+    if (force) {
+        pthread_mutex_lock(&pressure_lock);
+    } else if (pthread_mutex_trylock(&pressure_lock) != 0) {
+        return;
+    }
+
+    int level = pressure_poll(now, force);
 
-            printf("Allocated memory at: %p\n", (void *)(current + 1));
-            return (void *)(current + 1);  
+    pthread_mutex_lock(&large_lock);
+    int changed = level != pressure;
+    pressure = level;
+    large_cache_expire(now);
+    pthread_mutex_unlock(&large_lock);
+
+    if (changed && (size_t)level >= opt_purge_level) {
+        heap_purge();
+    }
+    pthread_mutex_unlock(&pressure_lock);
+}
+
+/**
+ * Take a cached mapping of exactly the given length
+ *
+ * @param len The mapping length wanted
+ * @return The mapping or NULL if none is cached
+ */
+static void *large_cache_take(size_t len) {
+    // Newest first, so the mapping most likely to still be warm is reused
+    for (size_t i = large_cache_count; i > 0; i--) {
+        if (large_cache[i - 1].len == len) {
+            void *base = large_cache[i - 1].base;
+            large_cache_remove(i - 1);
+            return base;
         }
-        prev = current;
-        current = current->next;
     }
+    return NULL;
+}
 
-    // If no suitable block, request new memory
-    free_block *new_block = (free_block *)sbrk(size + sizeof(free_block));
-    if (new_block == (void *)-1) {
-        // sbrk fails, print:
-        printf("Allocation failed: sbrk failed.\n");
-        return NULL; 
+/**
+ * Keep a released mapping for reuse, evicting the oldest ones to stay in bounds
+ *
+ * @param base The start of the mapping
+ * @param len The length of the mapping
+ * @param now The current monotonic time in ns
+ */
+static void large_cache_put(void *base, size_t len, uint64_t now) {
+    large_cache_expire(now);
+
+    if (len > large_cache_limit()) {
+        large_unmap(base, len);
+        return;
+    }
+    while (large_cache_count == LARGE_CACHE_SLOTS || large_cache_bytes + len > large_cache_limit()) {
+        large_unmap(large_cache[0].base, large_cache[0].len);
+        large_cache_remove(0);
     }
 
-    new_block->size = size;
-    new_block->next = NULL;
+    large_cache[large_cache_count].base = base;
+    large_cache[large_cache_count].len = len;
+    large_cache[large_cache_count].freed_at = now;
+    large_cache_count++;
+    large_cache_bytes += len;
+}
 
-    // Update next_fit_ptr after sbrk allocation
-    next_fit_ptr = NULL;  // Set to NULL; not needed atfer sbrk
+/**
+ * Get the start of the mapping backing a mapped block
+ *
+ * The header of a mapped block is always in the first page of its mapping,
+ * at the very start unless the block was aligned.
+ *
+ * @param block The header of the block
+ * @return The start of the mapping
+ */
+static char *map_base(header *block) {
+    return (char *)((uintptr_t)block & ~((uintptr_t)sysconf(_SC_PAGESIZE) - 1));
+}
 
-    printf("Allocated new memory at: %p\n", (void *)(new_block + 1));
-    return (void *)(new_block + 1);    
+/**
+ * Get the length of the mapping backing a mapped block
+ *
+ * @param block The header of the block
+ * @return The length of the mapping
+ */
+static size_t map_len(header *block) {
+    return (size_t)((char *)(block + 1) + block->size - map_base(block));
 }
-    
 
-    
+/**
+ * Get the bin index of a small size
+ *
+ * @param size The aligned size, at most SMALL_MAX
+ * @return The index into bins
+ */
+static size_t small_class(size_t size) {
+    return size / ALIGNMENT - 1;
+}
 
 /**
- * Allocates and initializes a list of elements for the end user
+ * Account for the bytes of a block becoming live or being released
  *
- * @param num How many elements to allocate
- * @param size The size of each element
- * @return A pointer to the requested block of initialized memory
+ * @param usable The usable size of the block
+ * @param span The bytes the block takes, header or whole mapping included
+ * @param sign 1 when the block becomes live, -1 when it is released
  */
-void *tucalloc(size_t num, size_t size) {
-    size_t total_size = num * size;
-    void *ptr = tumalloc(total_size);
-    if (ptr) {
-        memset(ptr, 0, total_size);  // mem set to 0
+static void stats_bytes(size_t usable, size_t span, int sign) {
+    stats_shard *sh = &thread_stats;
+    STAT_ADD(sh->allocated, sign > 0 ? usable : (size_t)0 - usable);
+    STAT_ADD(sh->active, sign > 0 ? span : (size_t)0 - span);
+    if (usable <= SMALL_MAX) {
+        STAT_ADD(sh->small_live[small_class(usable)], sign);
+        return;
     }
-    return ptr;
+    int bucket = log_bucket(usable) - log_bucket(SMALL_MAX);
+    if (bucket >= TUSTATS_LARGE_BUCKETS) {
+        bucket = TUSTATS_LARGE_BUCKETS - 1;
+    }
+    STAT_ADD(sh->large_live[bucket], sign);
+    STAT_ADD(sh->large_live_bytes[bucket], sign > 0 ? usable : (size_t)0 - usable);
 }
 
 /**
- * Reallocates a chunk of memory with a bigger size
+ * Account for an arena block becoming live or being released
  *
- * @param ptr A pointer to an already allocated piece of memory
- * @param new_size The new requested size to allocate
- * @return A new pointer containing the contents of ptr, but with the new_size
+ * @param index The index of the arena owning the block
+ * @param usable The usable size of the block
+ * @param slack The usable bytes beyond the request
+ * @param sign 1 when the block becomes live, -1 when it is released
  */
+static void stats_arena(unsigned index, size_t usable, size_t slack, int sign) {
+    stats_shard *sh = &thread_stats;
+    STAT_ADD(sh->arena_allocated[index], sign > 0 ? usable : (size_t)0 - usable);
+    STAT_ADD(sh->arena_live[index], sign);
+    STAT_ADD(sh->arena_slack[index], sign > 0 ? slack : (size_t)0 - slack);
+}
 
-void *turealloc(void *ptr, size_t new_size) {
-    if (!ptr) return tumalloc(new_size);  // if null, return to malloc
+/**
+ * Account for the bytes a block takes
+ *
+ * @param block The header of the block
+ * @param sign 1 when the block becomes live, -1 when it is released
+ */
+static void stats_block(header *block, int sign) {
+    if (block->magic == MAGIC_MMAP) {
+        stats_bytes(block->size, map_len(block), sign);
+        return;
+    }
+    stats_bytes(block->size, block->size + sizeof(header), sign);
+    stats_arena((unsigned)block->magic & MAGIC_ARENA_MASK, block->size, block->slack, sign);
+}
 
-    // snag block header
-    free_block *block = (free_block *)ptr - 1;
+/**
+ * Count a block handed out
+ *
+ * Also the hook of the heap profiler, which sees every block handed out.
+ *
+ * @param block The header of the block, with its magic number set
+ * @param request The size asked for, to remember the slack of arena blocks
+ */
+static void stats_alloc(header *block, size_t request) {
+    block->flags = 0;
+    if (block->magic != MAGIC_MMAP) {
+        size_t slack = block->size > request ? block->size - request : 0;
+        block->slack = slack < UINT16_MAX ? (uint16_t)slack : UINT16_MAX;
+    }
+    stats_block(block, 1);
+    STAT_ADD(thread_stats.nmalloc, 1);
+    if (opt_prof) {
+        prof_alloc(block, request);
+    }
+}
 
-    // If current block >, return ptr
-    if (block->size >= new_size) return ptr;
+/**
+ * Record a new request for a live block, keeping the arena's slack exact
+ *
+ * @param block The header of the block
+ * @param request The size the block is now asked to hold
+ */
+static void stats_slack(header *block, size_t request) {
+    if (block->magic == MAGIC_MMAP) {
+        return;
+    }
+    size_t slack = block->size > request ? block->size - request : 0;
+    slack = slack < UINT16_MAX ? slack : UINT16_MAX;
+    STAT_ADD(thread_stats.arena_slack[(unsigned)block->magic & MAGIC_ARENA_MASK], slack - block->slack);
+    block->slack = (uint16_t)slack;
+}
 
-    // allocate new block /copy  the data over
-    void *new_ptr = tumalloc(new_size);
-    if (new_ptr) {
-        memcpy(new_ptr, ptr, block->size);  // Cp data -> new blk
-        tufree(ptr);  // Free prev block
+/**
+ * Account for an arena block resized in place
+ *
+ * @param block The header of the block, with its new size
+ * @param old_size The usable size of the block before
+ * @param request The size the block is now asked to hold
+ */
+static void stats_resize(header *block, size_t old_size, size_t request) {
+    stats_bytes(old_size, old_size + sizeof(header), -1);
+    stats_bytes(block->size, block->size + sizeof(header), 1);
+    STAT_ADD(thread_stats.arena_allocated[(unsigned)block->magic & MAGIC_ARENA_MASK], block->size - old_size);
+    stats_slack(block, request);
+}
+
+/**
+ * Count a block released
+ *
+ * @param block The header of the block, still intact
+ */
+static void stats_free(header *block) {
+    stats_block(block, -1);
+    STAT_ADD(thread_stats.nfree, 1);
+    if (block->flags & HEADER_SAMPLED) {
+        prof_release(block);
     }
-    return new_ptr;
 }
 
 /**
- * Removes used chunk of memory and returns it to the free list
+ * Add one shard to another
  *
- * @param ptr Pointer to the allocated piece of memory
+ * @param sum The shard to add to
+ * @param sh The shard to add
  */
-void tufree(void *ptr) {
-    // extra cred next fit test case 
-    printf("Freeing block at: %p\n", ptr);
+static void stats_sum(stats_shard *sum, stats_shard *sh) {
+    STAT_ADD(sum->allocated, sh->allocated);
+    STAT_ADD(sum->active, sh->active);
+    STAT_ADD(sum->nmalloc, sh->nmalloc);
+    STAT_ADD(sum->nfree, sh->nfree);
+    STAT_ADD(sum->nrealloc, sh->nrealloc);
+    STAT_ADD(sum->tcache_hits, sh->tcache_hits);
+    STAT_ADD(sum->tcache_misses, sh->tcache_misses);
+    for (size_t cls = 0; cls < SMALL_CLASSES; cls++) {
+        STAT_ADD(sum->small_live[cls], sh->small_live[cls]);
+    }
+    for (size_t i = 0; i < TUSTATS_LARGE_BUCKETS; i++) {
+        STAT_ADD(sum->large_live[i], sh->large_live[i]);
+        STAT_ADD(sum->large_live_bytes[i], sh->large_live_bytes[i]);
+    }
+    for (size_t i = 0; i < MAX_ARENAS; i++) {
+        STAT_ADD(sum->arena_allocated[i], sh->arena_allocated[i]);
+        STAT_ADD(sum->arena_live[i], sh->arena_live[i]);
+        STAT_ADD(sum->arena_slack[i], sh->arena_slack[i]);
+    }
+#ifdef TUMALLOC_LATENCY
+    for (int op = 0; op < TULAT_OPS; op++) {
+        for (int group = 0; group < TULAT_SIZES; group++) {
+            for (int i = 0; i < LAT_BUCKETS; i++) {
+                STAT_ADD(sum->lat[op][group][i], sh->lat[op][group][i]);
+            }
+            if (sh->lat_max[op][group] > sum->lat_max[op][group]) {
+                sum->lat_max[op][group] = sh->lat_max[op][group];
+            }
+        }
+    }
+#endif
+}
 
-    if (!ptr) return;  // nah, do not free null ptr
+#ifdef TUMALLOC_LATENCY
+/**
+ * Get the latency bucket of a duration
+ *
+ * @param ns The duration in ns
+ * @return The bucket index, at most LAT_BUCKETS - 1
+ */
+static int lat_bucket(uint64_t ns) {
+    int i = log_bucket(ns);
+    return i < LAT_BUCKETS ? i : LAT_BUCKETS - 1;
+}
 
-    // Get the block header (before the memory block pointer)
-    free_block *block = (free_block *)ptr - 1;
+/**
+ * Get the size group a request is timed under
+ *
+ * @param size The request size
+ * @return TULAT_SMALL, TULAT_MEDIUM or TULAT_LARGE
+ */
+static int lat_group(size_t size) {
+    if (size <= SMALL_MAX) {
+        return TULAT_SMALL;
+    }
+    return size < opt_mmap_threshold ? TULAT_MEDIUM : TULAT_LARGE;
+}
 
-    // Add the block back to the free list
-    block->next = HEAD;
-    HEAD = block;
+/**
+ * Record how long a call took in the calling thread's histogram
+ *
+ * @param op TULAT_MALLOC, TULAT_FREE or TULAT_REALLOC
+ * @param size The request size, which picks the size group
+ * @param start When the call started, from now_ns
+ */
+static void lat_record(int op, size_t size, uint64_t start) {
+    uint64_t ns = now_ns() - start;
+    int group = lat_group(size);
+    STAT_ADD(thread_stats.lat[op][group][lat_bucket(ns)], 1);
+    if (ns > thread_stats.lat_max[op][group]) {
+        thread_stats.lat_max[op][group] = ns;
+    }
+}
+
+/**
+ * Get a percentile from a latency histogram
+ *
+ * @param hist The histogram
+ * @param count The number of calls in it
+ * @param q The percentile as a fraction, e.g. 0.99
+ * @return The upper bound of the bucket holding the percentile, in ns
+ */
+static uint64_t lat_percentile(_Atomic size_t *hist, size_t count, double q) {
+    size_t rank = (size_t)(q * count);
+    if (rank >= count) {
+        rank = count - 1;
+    }
+    size_t seen = 0;
+    for (int i = 0; i < LAT_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen > rank) {
+            return log_bucket_max(i);
+        }
+    }
+    return log_bucket_max(LAT_BUCKETS - 1);
+}
 
-    printf("Free operation completed. Update the free_list:\n");  
+/**
+ * Fill the latency summaries from summed histograms
+ *
+ * @param stats The statistics to fill
+ * @param sum The sum of all shards
+ */
+static void lat_summarize(tustats *stats, stats_shard *sum) {
+    for (int op = 0; op < TULAT_OPS; op++) {
+        for (int group = 0; group < TULAT_SIZES; group++) {
+            _Atomic size_t *hist = sum->lat[op][group];
+            tulatency *lat = &stats->latency[op][group];
+            uint64_t max = sum->lat_max[op][group];
+            lat->count = 0;
+            for (int i = 0; i < LAT_BUCKETS; i++) {
+                lat->count += hist[i];
+            }
+            if (lat->count == 0) {
+                lat->p50 = lat->p99 = lat->p999 = lat->max = 0;
+                continue;
+            }
+            // Bucket bounds can overshoot the slowest call actually seen
+            lat->p50 = lat_percentile(hist, lat->count, 0.5);
+            lat->p99 = lat_percentile(hist, lat->count, 0.99);
+            lat->p999 = lat_percentile(hist, lat->count, 0.999);
+            lat->p50 = lat->p50 < max ? lat->p50 : max;
+            lat->p99 = lat->p99 < max ? lat->p99 : max;
+            lat->p999 = lat->p999 < max ? lat->p999 : max;
+            lat->max = max;
+        }
+    }
+}
+
+#define LAT_START() uint64_t lat_start = now_ns() /**< Start timing a call */
+#define LAT_END(op, size) lat_record(op, size, lat_start) /**< Record the time since LAT_START */
+#else
+#define LAT_START() /**< Timing is compiled out */
+#define LAT_END(op, size) /**< Timing is compiled out */
+#endif
+
+/**
+ * Fold the shard of an exiting thread into the retired totals
+ *
+ * The shard is cleared and thread_ready reset, so a later call on this
+ * thread, for example from another destructor, registers it again.
+ *
+ * @param arg The thread's shard
+ */
+static void stats_exit(void *arg) {
+    stats_shard *sh = arg;
+    pthread_mutex_lock(&stats_lock);
+    stats_sum(&stats_retired, sh);
+    for (stats_shard **link = &stats_shards; *link; link = &(*link)->next) {
+        if (*link == sh) {
+            *link = sh->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    memset(sh, 0, sizeof(stats_shard));
+    thread_ready = 0;
+}
+
+/**
+ * Create the key whose destructor retires shards at thread exit
+ */
+static void stats_init(void) {
+    pthread_key_create(&stats_key, stats_exit);
+}
+
+/**
+ * Get a mapping of a given length, reusing a cached one if possible
+ *
+ * Cached mappings past their age are unmapped here too, after the lookup,
+ * so they do not wait for the next large free.
+ *
+ * @param len The length of the mapping, a multiple of the page size, or 0 if it does not fit
+ * @param fresh Set to 1 for a new mapping, which is all zero, and to 0 for a cached one
+ * @return The start of the mapping or NULL if the mapping failed
+ */
+static char *large_map(size_t len, int *fresh) {
+    if (len == 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    uint64_t now = now_ns();
+    pthread_mutex_lock(&large_lock);
+    char *base = large_cache_take(len);
+    if (base) {
+        large_cache_hits++;
+    } else {
+        large_cache_misses++;
+    }
+    large_cache_expire(now);
+    pthread_mutex_unlock(&large_lock);
+
+    *fresh = base == NULL;
+    if (base == NULL) {
+        pressure_update(now, 0);
+        base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            return NULL;
+        }
+        mapped_bytes += len;
+        PROBE2(map, base, len);
+    }
+    return base;
+}
+
+/**
+ * Allocate a block backed by its own mapping, reusing a cached one if possible
+ *
+ * @param size The aligned request size
+ * @param request The size asked for, for the profiler
+ * @param zero Clear the payload, unless the mapping is new and so already zero
+ * @return A pointer to the payload or NULL if the mapping failed
+ */
+static void *large_alloc(size_t size, size_t request, int zero) {
+    size_t len = large_map_len(size);
+    int fresh;
+    header *block = (header *)large_map(len, &fresh);
+    if (block == NULL) {
+        return NULL;
+    }
+
+    block->size = len - sizeof(header);
+    block->magic = MAGIC_MMAP;
+    stats_alloc(block, request);
+    if (zero && !fresh) {
+        memset(block + 1, 0, size);
+    } else if (zero) {
+        calloc_bytes_skipped += size;
+    }
+    return block + 1;
+}
+
+/**
+ * Allocate a block backed by its own mapping with a payload aligned beyond ALIGNMENT
+ *
+ * The header sits right before the aligned payload, and the whole pages in
+ * front of its page are unmapped again.
+ *
+ * @param align The alignment, a power of two larger than ALIGNMENT
+ * @param size The aligned request size
+ * @param request The size asked for, for the profiler
+ * @return A pointer to the payload or NULL if the mapping failed
+ */
+static void *large_alloc_aligned(size_t align, size_t size, size_t request) {
+    size_t len = large_map_len(size + align);
+    int fresh;
+    char *base = large_map(len, &fresh);
+    if (base == NULL) {
+        return NULL;
+    }
+
+    uintptr_t payload = ((uintptr_t)base + sizeof(header) + align - 1) & ~(uintptr_t)(align - 1);
+    header *block = (header *)payload - 1;
+    char *start = map_base(block);
+    if (start > base) {
+        large_unmap(base, (size_t)(start - base));
+    }
+
+    block->size = (size_t)(base + len - (char *)payload);
+    block->magic = MAGIC_MMAP;
+    stats_alloc(block, request);
+    return (void *)payload;
+}
+
+/**
+ * Release a block backed by its own mapping into the mapping cache
+ *
+ * @param block The header of the block
+ */
+static void large_free(header *block) {
+    stats_free(block);
+    uint64_t now = now_ns();
+    pressure_update(now, 0);
+
+    pthread_mutex_lock(&large_lock);
+    large_cache_put(map_base(block), map_len(block), now);
+    pthread_mutex_unlock(&large_lock);
+}
+
+/**
+ * Resize a block backed by its own mapping by remapping its pages
+ *
+ * The kernel moves the page table entries, so no payload is copied no
+ * matter how large the block is.
+ *
+ * @param block The header of the block
+ * @param size The aligned new size, at least opt_mmap_threshold
+ * @param may_move Whether the kernel may move the mapping, otherwise it is resized in place or not at all
+ * @return A pointer to the payload or NULL if the remap failed, in which case the block is untouched
+ */
+static void *large_realloc(header *block, size_t size, int may_move) {
+    char *base = map_base(block);
+    size_t offset = (size_t)((char *)block - base);
+    size_t old_len = map_len(block);
+    size_t len = large_map_len(size + offset);
+    if (len == 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (len == old_len) {
+        return block + 1;
+    }
+
+    // The offset within the page is kept, so alignments up to a page survive a move
+    char *moved_base = mremap(base, old_len, len, may_move ? MREMAP_MAYMOVE : 0);
+    if (moved_base == MAP_FAILED) {
+        return NULL;
+    }
+
+    header *moved = (header *)(moved_base + offset);
+    if (moved != block && (moved->flags & HEADER_SAMPLED)) {
+        prof_move(block, moved);
+    }
+    stats_bytes(moved->size, old_len, -1);
+    mapped_bytes += len - old_len;
+    moved->size = len - offset - sizeof(header);
+    stats_bytes(moved->size, len, 1);
+    realloc_remaps++;
+    return moved + 1;
+}
+
+/**
+ * Report the fragmentation of an arena
+ *
+ * Costs one arena lock and a pass over the per-thread counters, whatever
+ * the size of the heap. The numbers to alert on are external, the share of
+ * free memory a single large request cannot use, and the internal bytes,
+ * header_bytes plus rounding_bytes, against the footprint.
+ *
+ * @param index The index of the arena, 0 for the main heap
+ * @param frag Filled with the arena's fragmentation
+ * @return 0 on success, -1 if there is no such arena
+ */
+int tumalloc_frag(unsigned index, tufrag *frag) {
+    if (index >= arena_count()) {
+        return -1;
+    }
+
+    arena *a = &arenas[index];
+    pthread_mutex_lock(&a->lock);
+    frag->footprint = a->footprint;
+    frag->free_bytes = a->free_bytes;
+    frag->free_blocks = a->free_blocks;
+    int top = FRAG_BUCKETS - 1;
+    while (top >= 0 && a->free_hist[top] == 0) {
+        top--;
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    size_t allocated = 0;
+    size_t live = 0;
+    size_t slack = 0;
+    pthread_mutex_lock(&stats_lock);
+    allocated += stats_retired.arena_allocated[index];
+    live += stats_retired.arena_live[index];
+    slack += stats_retired.arena_slack[index];
+    for (stats_shard *sh = stats_shards; sh; sh = sh->next) {
+        allocated += sh->arena_allocated[index];
+        live += sh->arena_live[index];
+        slack += sh->arena_slack[index];
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    // The lowest size in the top bucket
+    frag->largest_free = top <= 0 ? 0 : (size_t)log_bucket_max(top - 1) + 1;
+    if (frag->largest_free > frag->free_bytes) {
+        frag->largest_free = frag->free_bytes;
+    }
+    frag->external = frag->free_bytes ? 1.0 - (double)frag->largest_free / (double)frag->free_bytes : 0.0;
+    frag->live_blocks = live;
+    frag->header_bytes = live * sizeof(header);
+    frag->rounding_bytes = slack;
+    frag->metadata_bytes = frag->free_blocks * sizeof(free_block) + sizeof(arena);
+
+    // Shards are read without stopping their threads, so this can be briefly off
+    size_t used = frag->free_bytes + frag->free_blocks * sizeof(free_block) + allocated + frag->header_bytes;
+    frag->cached_bytes = frag->footprint > used ? frag->footprint - used : 0;
+    return 0;
+}
+
+/**
+ * Report allocator statistics
+ *
+ * @param stats Filled with the current statistics
+ */
+void tumalloc_stats(tustats *stats) {
+    pthread_mutex_lock(&large_lock);
+    stats->large_cache_hits = large_cache_hits;
+    stats->large_cache_misses = large_cache_misses;
+    stats->large_cache_bytes = large_cache_bytes;
+    stats->large_cache_mappings = large_cache_count;
+    stats->pressure_level = pressure;
+    pthread_mutex_unlock(&large_lock);
+
+    stats->realloc_remaps = realloc_remaps;
+    stats->realloc_bytes_copied = realloc_bytes_copied;
+    stats->purged_bytes = purged_bytes;
+    stats->calloc_bytes_skipped = calloc_bytes_skipped;
+
+    pthread_mutex_lock(&arenas_lock);
+    unsigned count = narenas;
+    pthread_mutex_unlock(&arenas_lock);
+
+    stats->locked_bytes = 0;
+    stats->unpinned_bytes = 0;
+    memset(stats->search_depth, 0, sizeof(stats->search_depth));
+    stats->search_visited = 0;
+    stats->search_hits = 0;
+    stats->search_misses = 0;
+    stats->fit_wasted_bytes = 0;
+    for (unsigned i = 0; i < count; i++) {
+        arena *a = &arenas[i];
+        pthread_mutex_lock(&a->lock);
+        stats->locked_bytes += a->locked_bytes;
+        stats->unpinned_bytes += a->unpinned_bytes;
+        for (int b = 0; b < TUSTATS_SEARCH_BUCKETS; b++) {
+            stats->search_depth[b] += a->search_depth[b];
+        }
+        stats->search_visited += a->search_visited;
+        stats->search_hits += a->search_hits;
+        stats->search_misses += a->search_misses;
+        stats->fit_wasted_bytes += a->fit_wasted_bytes;
+        pthread_mutex_unlock(&a->lock);
+    }
+
+    // The per-thread counters are only added up here
+    stats_shard sum;
+    memset(&sum, 0, sizeof(sum));
+    pthread_mutex_lock(&stats_lock);
+    stats_sum(&sum, &stats_retired);
+    for (stats_shard *sh = stats_shards; sh; sh = sh->next) {
+        stats_sum(&sum, sh);
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    stats->allocated = sum.allocated;
+    stats->active = sum.active;
+    stats->mapped = mapped_bytes;
+    stats->retained = stats->mapped > stats->active ? stats->mapped - stats->active : 0;
+    stats->nmalloc = sum.nmalloc;
+    stats->nfree = sum.nfree;
+    stats->nrealloc = sum.nrealloc;
+    stats->tcache_hits = sum.tcache_hits;
+    stats->tcache_misses = sum.tcache_misses;
+    for (size_t cls = 0; cls < SMALL_CLASSES; cls++) {
+        stats->small_live[cls] = sum.small_live[cls];
+    }
+    for (size_t i = 0; i < TUSTATS_LARGE_BUCKETS; i++) {
+        stats->large_live[i] = sum.large_live[i];
+        stats->large_live_bytes[i] = sum.large_live_bytes[i];
+    }
+#ifdef TUMALLOC_LATENCY
+    lat_summarize(stats, &sum);
+#else
+    memset(stats->latency, 0, sizeof(stats->latency));
+#endif
+}
+
+/**
+ * Reread the cgroup and PSI files now and adapt the caches
+ *
+ * @return The new pressure level, from 0 (none) to 3 (critical)
+ */
+int tumalloc_pressure_update(void) {
+    pressure_update(now_ns(), 1);
+    pthread_mutex_lock(&large_lock);
+    int level = pressure;
+    pthread_mutex_unlock(&large_lock);
+    return level;
+}
+
+/**
+ * Apply TUMALLOC_CONF and create the configured arenas
+ *
+ * Runs once, before the first allocation of the process. The arenas grow
+ * with sbrk like the main heap and take indices 1 to opt_arenas - 1.
+ */
+static void conf_load(void) {
+    ctl_conf(getenv("TUMALLOC_CONF"));
+
+    pthread_mutex_lock(&arenas_lock);
+    while (narenas < opt_arenas && narenas < MAX_ARENAS) {
+        arena *a = &arenas[narenas++];
+        memset(a, 0, sizeof(arena));
+        pthread_mutex_init(&a->lock, NULL);
+    }
+    pthread_mutex_unlock(&arenas_lock);
+
+    report_conf_start();
+}
+
+/**
+ * Load TUMALLOC_CONF if that has not happened yet
+ */
+void conf_init(void) {
+    pthread_once(&conf_once, conf_load);
+}
+
+/**
+ * Set up the calling thread before its first allocation
+ *
+ * Makes sure the configuration is loaded, registers the thread's
+ * statistics shard, then spreads threads over the configured arenas round
+ * robin, unless the thread was bound to an arena already. Allocation entry points only test thread_ready, so an unset
+ * TUMALLOC_CONF costs nothing after this.
+ */
+static void thread_init(void) {
+    conf_init();
+    thread_ready = 1;
+
+    pthread_once(&stats_once, stats_init);
+    pthread_setspecific(stats_key, &thread_stats);
+    pthread_mutex_lock(&stats_lock);
+    thread_stats.next = stats_shards;
+    stats_shards = &thread_stats;
+    pthread_mutex_unlock(&stats_lock);
+
+    if (opt_arenas > 1 && thread_arena == 0) {
+        thread_arena = arena_next++ % (unsigned)opt_arenas;
+    }
+}
+
+/**
+ * Map a new chunk for a locked arena
+ *
+ * Tries MAP_LOCKED first. When RLIMIT_MEMLOCK is too low for that, the
+ * chunk is mapped normally and mlock is attempted; if that fails as well,
+ * the chunk is still pre-faulted so steady-state use does not fault, and
+ * it is counted as unpinned.
+ *
+ * @param a The locked arena
+ * @param size The aligned size of the request that needs the chunk
+ * @return The chunk as a single free block, or NULL if it cannot be mapped
+ */
+static free_block *locked_chunk(arena *a, size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t len = size + sizeof(free_block) > LOCKED_CHUNK ? size + sizeof(free_block) : LOCKED_CHUNK;
+    len = (len + page - 1) & ~(page - 1);
+
+    int pinned = 1;
+    void *base = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_LOCKED | MAP_POPULATE, -1, 0);
+    if (base == MAP_FAILED) {
+        base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (base == MAP_FAILED) {
+            return NULL;
+        }
+        pinned = mlock(base, len) == 0;
+    }
+
+    mapped_bytes += len;
+    a->footprint += len;
+    if (pinned) {
+        a->locked_bytes += len;
+    } else {
+        a->unpinned_bytes += len;
+    }
+
+    free_block *chunk = base;
+    chunk->size = len - sizeof(free_block);
+    return chunk;
+}
+
+/**
+ * Create an arena whose memory is pinned and never purged
+ *
+ * Allocations from a locked arena, large ones included, never take a page
+ * fault once the arena holds enough memory. Direct a thread to it with
+ * tuarena_bind.
+ *
+ * @param reserve The number of bytes to map and pin up front
+ * @return The index of the new arena, or -1 if no arena can be created
+ */
+int tuarena_create_locked(size_t reserve) {
+    // Configured arenas come first
+    conf_init();
+
+    pthread_mutex_lock(&arenas_lock);
+    if (narenas == MAX_ARENAS) {
+        pthread_mutex_unlock(&arenas_lock);
+        return -1;
+    }
+
+    arena *a = &arenas[narenas];
+    memset(a, 0, sizeof(arena));
+    pthread_mutex_init(&a->lock, NULL);
+    a->locked = 1;
+
+    free_block *chunk = locked_chunk(a, (reserve + ALIGNMENT - 1) & ~(ALIGNMENT - 1));
+    if (chunk == NULL) {
+        pthread_mutex_unlock(&arenas_lock);
+        return -1;
+    }
+    chunk->next = NULL;
+    a->head = chunk;
+    free_add(a, chunk);
+
+    int index = (int)narenas++;
+    pthread_mutex_unlock(&arenas_lock);
+    return index;
+}
+
+/**
+ * Grow the heap with sbrk
+ *
+ * The main heap and the arenas created by TUMALLOC_CONF all grow the same
+ * break, so calls are serialized here.
+ *
+ * @param len The number of bytes to add, a multiple of ALIGNMENT
+ * @return The start of the new memory, or (void *)-1 on failure
+ */
+static void *heap_sbrk(size_t len) {
+    pthread_mutex_lock(&sbrk_lock);
+    char *start = sbrk(len);
+    if (start != (void *)-1) {
+        mapped_bytes += len;
+    }
+    pthread_mutex_unlock(&sbrk_lock);
+    return start;
+}
+
+/**
+ * Get the alignment level of an alignment
+ *
+ * @param align A power of two of at least ALIGNMENT
+ * @return 0 for ALIGNMENT, one more per doubling, capped at ALIGN_LEVELS - 1
+ */
+static unsigned align_level(uintptr_t align) {
+    unsigned level = (unsigned)__builtin_ctzl(align) - (unsigned)__builtin_ctz(ALIGNMENT);
+    return level < ALIGN_LEVELS ? level : ALIGN_LEVELS - 1;
+}
+
+/**
+ * Put a small block into its size-class bin
+ *
+ * The block is counted at its class size, which it always has exactly, so
+ * a thread cache flush writes the cold blocks but does not wait to read them.
+ *
+ * @param a The arena owning the bin
+ * @param block The block, at most SMALL_MAX bytes
+ * @param cls The size class of the block
+ */
+static void bin_push(arena *a, free_block *block, size_t cls) {
+    size_t size = (cls + 1) * ALIGNMENT;
+    a->free_bytes += size;
+    a->free_blocks++;
+    a->free_hist[log_bucket(size)]++;
+    size_bin *bin = &a->bins[cls];
+    unsigned level = align_level((uintptr_t)(block + 1));
+    block->next = bin->lists[level];
+    bin->lists[level] = block;
+    bin->mask |= 1u << level;
+}
+
+/**
+ * Take a block from a size-class bin
+ *
+ * @param a The arena owning the bin
+ * @param cls The size class
+ * @param level The minimum alignment level of the payload
+ * @return The block, or NULL if the bin has none aligned well enough
+ */
+static free_block *bin_pop(arena *a, size_t cls, unsigned level) {
+    size_bin *bin = &a->bins[cls];
+    unsigned mask = bin->mask >> level;
+    if (mask == 0) {
+        return NULL;
+    }
+
+    level += (unsigned)__builtin_ctz(mask);
+    free_block *block = bin->lists[level];
+    bin->lists[level] = block->next;
+    if (bin->lists[level] == NULL) {
+        bin->mask &= ~(1u << level);
+    }
+    free_sub(a, block);
+    return block;
+}
+
+/**
+ * A slice of a reservation to fault in
+ */
+typedef struct prefault_job {
+    char *start; /**< First byte of the slice */
+    size_t len; /**< Length of the slice */
+    size_t page; /**< The page size */
+} prefault_job;
+
+/**
+ * Fault in a slice of memory by writing one byte per page
+ *
+ * @param arg The prefault_job describing the slice
+ * @return NULL
+ */
+static void *touch_pages(void *arg) {
+    prefault_job *job = arg;
+    for (size_t off = 0; off < job->len; off += job->page) {
+        ((volatile char *)job->start)[off] = 0;
+    }
+    return NULL;
+}
+
+/**
+ * Fault in freshly reserved memory
+ *
+ * @param start The start of the memory
+ * @param len The length of the memory
+ * @param flags The TUPREWARM_* flags given to tumalloc_prewarm
+ */
+static void prefault(char *start, size_t len, int flags) {
+    if ((flags & TUPREWARM_POPULATE)) {
+        uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+        uintptr_t first = ((uintptr_t)start + page - 1) & ~(page - 1);
+        uintptr_t last = ((uintptr_t)start + len) & ~(page - 1);
+        if (last <= first || madvise((void *)first, last - first, MADV_POPULATE_WRITE) == 0) {
+            return;
+        }
+        // Kernel too old, touch the pages instead
+    }
+    if (!(flags & (TUPREWARM_TOUCH | TUPREWARM_POPULATE))) {
+        return;
+    }
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = (flags & TUPREWARM_THREADS) && cpus > 1 ? (size_t)cpus : 1;
+    if (threads > PREWARM_THREADS) {
+        threads = PREWARM_THREADS;
+    }
+
+    prefault_job jobs[PREWARM_THREADS];
+    pthread_t tids[PREWARM_THREADS];
+    size_t slice = (len / threads + page - 1) & ~(page - 1);
+    size_t started = 0;
+    for (size_t i = 0; i < threads && i * slice < len; i++) {
+        jobs[i].start = start + i * slice;
+        jobs[i].len = len - i * slice < slice ? len - i * slice : slice;
+        jobs[i].page = page;
+        // The first slice is done by the calling thread
+        if (i > 0 && pthread_create(&tids[i], NULL, touch_pages, &jobs[i]) == 0) {
+            started |= (size_t)1 << i;
+        } else if (i > 0) {
+            touch_pages(&jobs[i]);
+        }
+    }
+    touch_pages(&jobs[0]);
+    for (size_t i = 1; i < threads; i++) {
+        if (started & ((size_t)1 << i)) {
+            pthread_join(tids[i], NULL);
+        }
+    }
+}
+
+/**
+ * Carve part of a reservation into blocks for every size-class bin
+ *
+ * Each class gets an equal share of the budget in bytes.
+ *
+ * @param a The arena owning the bins
+ * @param start The start of the memory to carve
+ * @param budget The number of bytes to carve
+ * @return The number of bytes used
+ */
+static size_t seed_bins(arena *a, char *start, size_t budget) {
+    size_t share = budget / SMALL_CLASSES;
+    char *curr = start;
+    for (size_t cls = 0; cls < SMALL_CLASSES; cls++) {
+        size_t size = (cls + 1) * ALIGNMENT;
+        for (size_t used = 0; used + size + sizeof(free_block) <= share; used += size + sizeof(free_block)) {
+            free_block *block = (free_block *)curr;
+            block->size = size;
+            bin_push(a, block, cls);
+            curr += size + sizeof(free_block);
+        }
+    }
+    return (size_t)(curr - start);
+}
+
+/**
+ * Reserve heap memory in advance so early allocations avoid sbrk and page faults
+ *
+ * The reservation joins the main heap's free list. With TUPREWARM_SEED,
+ * half of it is carved into blocks for the size-class bins first.
+ *
+ * @param bytes The number of bytes to reserve
+ * @param flags A combination of TUPREWARM_* flags
+ * @return 0 on success, -1 if the memory cannot be reserved
+ */
+int tumalloc_prewarm(size_t bytes, int flags) {
+    conf_init();
+    bytes = (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (bytes < 2 * sizeof(free_block)) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&arenas[0].lock);
+    char *start = heap_sbrk(bytes);
+    pthread_mutex_unlock(&arenas[0].lock);
+    if (start == (void *)-1) {
+        return -1;
+    }
+    prefault(start, bytes, flags);
+
+    arena *a = &arenas[0];
+    pthread_mutex_lock(&a->lock);
+    size_t seeded = (flags & TUPREWARM_SEED) ? seed_bins(a, start, bytes / 2) : 0;
+
+    free_block *rest = (free_block *)(start + seeded);
+    rest->size = bytes - seeded - sizeof(free_block);
+    rest->next = a->head;
+    a->head = rest;
+    a->footprint += bytes;
+    free_add(a, rest);
+    pthread_mutex_unlock(&a->lock);
+    return 0;
+}
+/**
+ * Get more memory for an arena
+ *
+ * The main heap asks sbrk for exactly the block needed. A locked arena maps
+ * a new pinned chunk and hands out its tail, keeping the rest on its free
+ * list.
+ *
+ * @param a The arena to grow, locked by the caller
+ * @param size The aligned size of the block needed
+ * @return The new block, or NULL if the OS is out of memory
+ */
+static free_block *arena_grow(arena *a, size_t size) {
+    if (!a->locked) {
+        free_block *new_block = (free_block *)heap_sbrk(size + sizeof(free_block));
+        if (new_block == (void *)-1) {
+            return NULL;
+        }
+        a->footprint += size + sizeof(free_block);
+        new_block->size = size;
+        return new_block;
+    }
+
+    free_block *chunk = locked_chunk(a, size);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    if (chunk->size <= size + sizeof(free_block)) {
+        return chunk;
+    }
+
+    chunk->size -= size + sizeof(free_block);
+    chunk->next = a->head;
+    a->head = chunk;
+    free_add(a, chunk);
+    free_block *tail = (free_block *)((char *)(chunk + 1) + chunk->size);
+    tail->size = size;
+    return tail;
+}
+
+/**
+ * Forget the purged ranges a block handed out overlaps
+ *
+ * The largest overlap with the block is left in last_zero_lo and
+ * last_zero_hi for tucalloc. Parts of a range outside the block stay.
+ *
+ * @param a The arena owning the block, locked by the caller
+ * @param block The header of the block about to be handed out
+ */
+static void zero_clip(arena *a, free_block *block) {
+    uintptr_t lo = (uintptr_t)block;
+    uintptr_t hi = (uintptr_t)(block + 1) + block->size;
+    unsigned i = 0;
+    while (i < a->zero_spans) {
+        uintptr_t span_lo = a->zero_lo[i];
+        uintptr_t span_hi = a->zero_hi[i];
+        if (span_hi <= lo || span_lo >= hi) {
+            i++;
+            continue;
+        }
+
+        uintptr_t keep_lo = span_lo > lo ? span_lo : lo;
+        uintptr_t keep_hi = span_hi < hi ? span_hi : hi;
+        if (keep_hi - keep_lo > a->last_zero_hi - a->last_zero_lo) {
+            a->last_zero_lo = keep_lo;
+            a->last_zero_hi = keep_hi;
+        }
+
+        if (span_lo < lo && span_hi > hi) {
+            // The block sits inside the range, keep the part after it if there is room
+            a->zero_hi[i] = lo;
+            if (a->zero_spans < ZERO_SPANS) {
+                a->zero_lo[a->zero_spans] = hi;
+                a->zero_hi[a->zero_spans++] = span_hi;
+            }
+            i++;
+        } else if (span_lo < lo) {
+            a->zero_hi[i++] = lo;
+        } else if (span_hi > hi) {
+            a->zero_lo[i++] = hi;
+        } else {
+            a->zero_spans--;
+            a->zero_lo[i] = a->zero_lo[a->zero_spans];
+            a->zero_hi[i] = a->zero_hi[a->zero_spans];
+        }
+    }
+}
+
+/**
+ * Get the search depth bucket of a free-list search
+ *
+ * @param visited The number of free blocks the search looked at
+ * @return 0 for none, otherwise i such that 2^(i-1) <= visited < 2^i, capped at the last bucket
+ */
+static int search_bucket(size_t visited) {
+    int i = visited ? 64 - __builtin_clzll(visited) : 0;
+    return i < TUSTATS_SEARCH_BUCKETS ? i : TUSTATS_SEARCH_BUCKETS - 1;
+}
+
+/**
+ * Allocate a block from an arena
+ *
+ * Also records which part of the block is known to be zero in
+ * last_zero_lo and last_zero_hi. Small blocks are always exactly the size
+ * asked for, so a free block only one header larger is passed over for
+ * them rather than handed out whole.
+ *
+ * @param a The arena to allocate from, locked by the caller
+ * @param size The aligned size, at least ALIGNMENT
+ * @param grew Set to 1 if the arena had to grow, untouched otherwise
+ * @return The header of the block, or NULL if the OS is out of memory
+ */
+static free_block *arena_alloc(arena *a, size_t size, int *grew) {
+    a->last_zero_lo = 0;
+    a->last_zero_hi = 0;
+
+    // Small requests are served from their size-class bin first
+    free_block *block = size <= SMALL_MAX ? bin_pop(a, small_class(size), 0) : NULL;
+    if (block) {
+        TRACE(TRACE_BIN, block + 1, size, 0);
+        return block;
+    }
+
+    // next, search the free list: next fit starts from next_fit (or the head) and wraps
+    // around once, first and best fit start from the head
+    int fit = opt_fit;
+    free_block *start = fit == FIT_NEXT && a->next_fit ? a->next_fit : a->head;
+    free_block *current = start;
+    free_block *prev = NULL;
+    free_block *found = NULL;
+    free_block *found_prev = NULL;
+    size_t visited = 0;
+    size_t unsplit = size <= SMALL_MAX ? size + sizeof(free_block) : 0;
+
+    // Traverse free list to find suitable block size
+    while (current) {
+        visited++;
+        if (current->size >= size && current->size != unsplit && (found == NULL || current->size < found->size)) {
+            found = current;
+            found_prev = prev;
+
+            // Best fit keeps looking unless the block is too small to split anyway
+            if (fit != FIT_BEST || current->size <= size + sizeof(free_block)) {
+                break;
+            }
+        }
+        prev = current;
+        current = current->next;
+        if (current == NULL && start != a->head) {
+            prev = NULL;
+            current = a->head;
+        }
+        if (current == start) {
+            break;
+        }
+    }
+
+    a->search_depth[search_bucket(visited)]++;
+    a->search_visited += visited;
+    if (found) {
+        a->search_hits++;
+        current = found;
+        prev = found_prev;
+
+        // If necessary, split block, handing out its tail so the rest stays linked in place
+        if (current->size > size + sizeof(free_block)) {
+            free_sub(a, current);
+            current->size -= size + sizeof(free_block);
+            free_add(a, current);
+            free_block *tail = (free_block *)((char *)(current + 1) + current->size);
+            tail->size = size;
+            a->next_fit = current;
+            if (a->zero_spans) {
+                zero_clip(a, tail);
+            }
+
+            TRACE(TRACE_SPLIT, tail + 1, size, 0);
+            return tail;
+        }
+
+        // Remove the block from the free list
+        a->fit_wasted_bytes += current->size - size;
+        if (prev) {
+            free_sub(a, current);
+            prev->next = current->next;
+        } else if (current == a->head) {
+            free_sub(a, current);
+            a->head = current->next;
+        } else {
+            remove_free_block(a, current);
+        }
+
+        // Update the next_fit to the next free block
+        a->next_fit = current->next ? current->next : a->head;
+        if (a->zero_spans) {
+            zero_clip(a, current);
+        }
+
+        TRACE(TRACE_FIT, current + 1, size, 0);
+        return current;
+    }
+
+    // If no suitable block, request new memory
+    a->search_misses++;
+    *grew = 1;
+    free_block *new_block = arena_grow(a, size);
+    PROBE3(heap_grow, a - arenas, size, new_block ? new_block + 1 : NULL);
+    if (new_block == NULL) {
+        TRACE(TRACE_GROW_FAIL, NULL, size, 0);
+        return NULL;
+    }
+
+    // Update next_fit after growing
+    a->next_fit = NULL;  // Set to NULL; not needed atfer sbrk
+
+    // New memory is zero, except possibly the rest of the page the break was in
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    a->last_zero_lo = ((uintptr_t)(new_block + 1) + page - 1) & ~(page - 1);
+    a->last_zero_hi = (uintptr_t)(new_block + 1) + new_block->size;
+    if (a->last_zero_lo > a->last_zero_hi) {
+        a->last_zero_lo = a->last_zero_hi;
+    }
+
+    TRACE(TRACE_GROW, new_block + 1, size, 0);
+    return new_block;
+}
+
+/**
+ * Return a block to an arena
+ *
+ * @param a The arena owning the block, locked by the caller
+ * @param block The header of the block
+ */
+static void arena_free(arena *a, free_block *block) {
+    // Small blocks go back to their size-class bin
+    if (block->size <= SMALL_MAX) {
+        bin_push(a, block, small_class(block->size));
+        TRACE(TRACE_BIN_FREE, block + 1, block->size, 0);
+        return;
+    }
+
+    // Merge with free neighbors, then add the block back to the free list
+    block = coalesce(a, block);
+    block->next = a->head;
+    a->head = block;
+    free_add(a, block);
+
+    TRACE(TRACE_LIST_FREE, block + 1, block->size, 0);
+}
+
+/**
+ * Return the oldest cached blocks of a size class to the thread's arena
+ *
+ * @param cls The size class
+ * @param n The number of blocks to return
+ */
+static void tcache_flush(size_t cls, unsigned n) {
+    tcache *tc = &thread_cache;
+    arena *a = &arenas[thread_arena];
+    pthread_mutex_lock(&a->lock);
+    for (unsigned i = 0; i < n; i++) {
+        bin_push(a, tc->slots[cls][i], cls);
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    tc->count[cls] -= n;
+    memmove(tc->slots[cls], tc->slots[cls] + n, tc->count[cls] * sizeof(free_block *));
+}
+
+/**
+ * Return every cached block to the thread's arena
+ */
+static void tcache_flush_all(void) {
+    for (size_t cls = 0; cls < SMALL_CLASSES; cls++) {
+        if (thread_cache.count[cls]) {
+            tcache_flush(cls, thread_cache.count[cls]);
+        }
+    }
+}
+
+/**
+ * Flush the cache of an exiting thread
+ *
+ * @param arg Unused
+ */
+static void tcache_exit(void *arg) {
+    (void)arg;
+    tcache_flush_all();
+}
+
+/**
+ * Create the key whose destructor flushes caches at thread exit
+ */
+static void tcache_init(void) {
+    pthread_key_create(&tcache_key, tcache_exit);
+}
+
+/**
+ * Cache a free small block of the thread's arena, flushing half the class when full
+ *
+ * @param block The block, with its allocated header intact
+ * @param cls The size class to cache it under
+ */
+static void tcache_push(free_block *block, size_t cls) {
+    tcache *tc = &thread_cache;
+    if (!tc->registered) {
+        pthread_once(&tcache_once, tcache_init);
+        pthread_setspecific(tcache_key, tc);
+        tc->registered = 1;
+    }
+    unsigned slots = (unsigned)opt_tcache_slots;
+    if (tc->count[cls] >= slots) {
+        tcache_flush(cls, tc->count[cls] - slots / 2);
+    }
+    tc->slots[cls][tc->count[cls]++] = block;
+}
+
+/**
+ * Take a cached block of a size class, refilling from the arena's bin when empty
+ *
+ * A refill moves up to half a cache worth of blocks under a single lock.
+ *
+ * @param cls The size class
+ * @return The block with a valid allocated header, or NULL if the bin is empty too
+ */
+static free_block *tcache_pop(size_t cls) {
+    tcache *tc = &thread_cache;
+    if (tc->count[cls] == 0) {
+        STAT_ADD(thread_stats.tcache_misses, 1);
+        arena *a = &arenas[thread_arena];
+        pthread_mutex_lock(&a->lock);
+        free_block *block;
+        unsigned refill = (unsigned)(opt_tcache_slots + 1) / 2;
+        while (tc->count[cls] < refill && (block = bin_pop(a, cls, 0)) != NULL) {
+            ((header *)block)->magic = MAGIC_HEAP | (int)(a - arenas);
+            tc->slots[cls][tc->count[cls]++] = block;
+        }
+        pthread_mutex_unlock(&a->lock);
+        if (tc->count[cls] == 0) {
+            return NULL;
+        }
+    } else {
+        STAT_ADD(thread_stats.tcache_hits, 1);
+    }
+    return tc->slots[cls][--tc->count[cls]];
+}
+
+/**
+ * Carve a run of small blocks whose payloads all have a given alignment
+ *
+ * The size must be a multiple of the alignment, so the blocks sit one
+ * stride apart. The gap between two blocks, and the lead and tail of the
+ * run, go back to the arena as free blocks of their own.
+ *
+ * @param a The arena to carve from, locked by the caller
+ * @param size The size class, a multiple of align
+ * @param align The alignment, a power of two larger than ALIGNMENT
+ * @param count The number of blocks wanted, at least 1
+ * @param out Filled with the headers of the blocks, magic not set
+ * @param grew Set to 1 if the arena had to grow, untouched otherwise
+ * @return count, or 0 if the OS is out of memory
+ */
+static unsigned arena_carve_aligned(arena *a, size_t size, size_t align, unsigned count, free_block **out,
+                                    int *grew) {
+    // Room for a gap of at least one free block after every block, and for a lead of up to align + 16 bytes
+    size_t stride = (size + 2 * sizeof(free_block) + ALIGNMENT + align - 1) & ~(align - 1);
+    free_block *run = arena_alloc(a, count * stride + align + sizeof(free_block), grew);
+    if (run == NULL) {
+        return 0;
+    }
+
+    char *end = (char *)(run + 1) + run->size;
+    uintptr_t payload = ((uintptr_t)(run + 1) + align - 1) & ~(uintptr_t)(align - 1);
+    if (payload != (uintptr_t)(run + 1) && payload - (uintptr_t)(run + 1) < sizeof(free_block) + ALIGNMENT) {
+        payload += align;
+    }
+    if ((free_block *)payload - 1 != run) {
+        run->size = (size_t)((char *)payload - sizeof(free_block) - (char *)(run + 1));
+        arena_free(a, run);
+    }
+
+    for (unsigned i = 0; i < count; i++, payload += stride) {
+        free_block *block = (free_block *)payload - 1;
+        block->size = size;
+        out[i] = block;
+
+        // The gap up to the next block, or the rest of the run after the last one
+        free_block *gap = (free_block *)(payload + size);
+        char *next = i + 1 < count ? (char *)(payload + stride) - sizeof(free_block) : end;
+        gap->size = (size_t)(next - (char *)(gap + 1));
+        arena_free(a, gap);
+    }
+    return count;
+}
+
+/**
+ * Take a cached block of a size class whose payload has a given alignment
+ *
+ * The cached pointers are looked at newest first. When none is aligned,
+ * up to half a cache worth of blocks is moved from the bin lists of
+ * sufficient alignment under a single lock, as tcache_pop does, and if
+ * the bins have none and the class size is a multiple of the alignment,
+ * a run of aligned blocks is carved instead.
+ *
+ * @param cls The size class
+ * @param align The alignment, a power of two up to the last bin level
+ * @return The block with a valid allocated header, or NULL to fall back to the arena
+ */
+static free_block *tcache_pop_aligned(size_t cls, size_t align) {
+    tcache *tc = &thread_cache;
+    for (unsigned i = tc->count[cls]; i-- > 0;) {
+        free_block *block = tc->slots[cls][i];
+        if ((uintptr_t)(block + 1) % align == 0) {
+            tc->slots[cls][i] = tc->slots[cls][--tc->count[cls]];
+            STAT_ADD(thread_stats.tcache_hits, 1);
+            return block;
+        }
+    }
+
+    STAT_ADD(thread_stats.tcache_misses, 1);
+    arena *a = &arenas[thread_arena];
+    size_t size = (cls + 1) * ALIGNMENT;
+    unsigned slots = (unsigned)opt_tcache_slots;
+    unsigned refill = (slots + 1) / 2;
+    if (tc->count[cls] + refill > slots) {
+        tcache_flush(cls, tc->count[cls] + refill - slots);
+    }
+    unsigned base = tc->count[cls];
+    int grew = 0;
+    pthread_mutex_lock(&a->lock);
+    free_block *block;
+    while (tc->count[cls] - base < refill && (block = bin_pop(a, cls, align_level(align))) != NULL) {
+        tc->slots[cls][tc->count[cls]++] = block;
+    }
+    if (tc->count[cls] == base && size % align == 0) {
+        tc->count[cls] += arena_carve_aligned(a, size, align, refill, tc->slots[cls] + base, &grew);
+    }
+    for (unsigned i = base; i < tc->count[cls]; i++) {
+        ((header *)tc->slots[cls][i])->magic = MAGIC_HEAP | (int)(a - arenas);
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    if (grew) {
+        pressure_update(now_ns(), 0);
+    }
+    if (tc->count[cls] == base) {
+        return NULL;
+    }
+    return tc->slots[cls][--tc->count[cls]];
+}
+
+/**
+ * Direct the calling thread's allocations to an arena
+ *
+ * @param index The arena index, 0 for the main heap
+ * @return 0 on success, -1 if the arena does not exist
+ */
+int tuarena_bind(unsigned index) {
+    if (!thread_ready) {
+        thread_init();
+    }
+
+    pthread_mutex_lock(&arenas_lock);
+    int exists = index < narenas;
+    pthread_mutex_unlock(&arenas_lock);
+    if (!exists) {
+        return -1;
+    }
+
+    // Cached blocks belong to the old arena
+    tcache_flush_all();
+    thread_arena = index;
+    return 0;
+}
+
+/**
+ * Allocate memory, the untimed body of tumalloc
+ *
+ * @param size The amount of memory to allocate
+ * @return A pointer to the requested block of memory, or NULL with errno set to ENOMEM
+ */
+static void *do_malloc(size_t size) {
+    if (!thread_ready) {
+        thread_init();
+    }
+    arena *a = &arenas[thread_arena];
+
+    // Track and test extra cred Next fit, the pointer goes in the trace
+    TRACE(TRACE_MALLOC, a->next_fit, size, thread_arena);
+
+    // Rounding up and the header of a mapping must not wrap around
+    if (size > SIZE_MAX / 2) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // Align the size / rounding up to nearest block size
+    size_t request = size;
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1); 
+    if (size == 0) {
+        size = ALIGNMENT;
+    }
+
+    // Large requests bypass the free list and get their own mapping, unless the arena is pinned
+    if (size >= opt_mmap_threshold && !a->locked) {
+        void *ptr = large_alloc(size, request, 0);
+        TRACE(TRACE_MAP, ptr, size, 0);
+        return ptr;
+    }
+
+    // Small requests try the thread cache before taking the arena lock
+    free_block *block = size <= SMALL_MAX ? tcache_pop(small_class(size)) : NULL;
+    if (block) {
+        stats_alloc((header *)block, request);
+        TRACE(TRACE_TCACHE, block + 1, size, 0);
+        return block + 1;
+    }
+
+    int grew = 0;
+    pthread_mutex_lock(&a->lock);
+    block = arena_alloc(a, size, &grew);
+    if (block) {
+        ((header *)block)->magic = MAGIC_HEAP | (int)(a - arenas);
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    if (grew) {
+        pressure_update(now_ns(), 0);
+    }
+    if (block == NULL) {
+        return NULL;
+    }
+    stats_alloc((header *)block, request);
+    return block + 1;
+}
+
+/**
+ * Allocates memory for the end user
+ *
+ * @param size The amount of memory to allocate
+ * @return A pointer to the requested block of memory, or NULL with errno set to ENOMEM
+ */
+void *tumalloc(size_t size) {
+    PROBE1(malloc_entry, size);
+    LAT_START();
+    void *ptr = do_malloc(size);
+    LAT_END(TULAT_MALLOC, size);
+    PROBE2(malloc_return, ptr, size);
+    EXPORT_TICK();
+    return ptr;
+}
+
+/**
+ * Allocate a block from an arena with a payload aligned beyond ALIGNMENT
+ *
+ * Small requests come from a bin list of sufficient alignment when
+ * possible. Otherwise an over-sized block is carved: the leading slack
+ * before the aligned payload and any trailing excess go back to the arena
+ * as free blocks.
+ *
+ * @param a The arena to allocate from, locked by the caller
+ * @param align The alignment, a power of two larger than ALIGNMENT
+ * @param size The aligned size, at least ALIGNMENT
+ * @param grew Set to 1 if the arena had to grow, untouched otherwise
+ * @return The header of the block, or NULL if the OS is out of memory
+ */
+static free_block *arena_alloc_aligned(arena *a, size_t align, size_t size, int *grew) {
+    if (size <= SMALL_MAX && align <= (size_t)ALIGNMENT << (ALIGN_LEVELS - 1)) {
+        free_block *block = bin_pop(a, small_class(size), align_level(align));
+        if (block) {
+            return block;
+        }
+    }
+
+    // Leave room for a leading free block of at least ALIGNMENT bytes, and for
+    // a trailing one whatever the lead, so the block is never left one header large
+    free_block *block = arena_alloc(a, size + align + 3 * sizeof(free_block), grew);
+    if (block == NULL) {
+        return NULL;
+    }
+
+    uintptr_t payload = ((uintptr_t)(block + 1) + align - 1) & ~(uintptr_t)(align - 1);
+    if (payload != (uintptr_t)(block + 1) && payload - (uintptr_t)(block + 1) < sizeof(free_block) + ALIGNMENT) {
+        payload += align;
+    }
+
+    char *end = (char *)(block + 1) + block->size;
+    free_block *aligned = (free_block *)payload - 1;
+    if (aligned != block) {
+        block->size = (size_t)((char *)aligned - (char *)(block + 1));
+        arena_free(a, block);
+    }
+    aligned->size = (size_t)(end - (char *)payload);
+
+    // Give back the excess at the end
+    if (aligned->size >= size + sizeof(free_block) + ALIGNMENT) {
+        free_block *tail = (free_block *)((char *)payload + size);
+        tail->size = aligned->size - size - sizeof(free_block);
+        aligned->size = size;
+        arena_free(a, tail);
+    }
+    return aligned;
+}
+
+/**
+ * Allocate a block from a given arena without going through the thread cache
+ *
+ * @param a The arena to allocate from, not locked
+ * @param align The alignment, a power of two, ALIGNMENT or less for the default
+ * @param size The aligned size, at least ALIGNMENT
+ * @param request The size asked for, to remember the slack
+ * @return A pointer to the payload or NULL if the OS is out of memory
+ */
+static void *arena_malloc(arena *a, size_t align, size_t size, size_t request) {
+    if (size >= opt_mmap_threshold && !a->locked) {
+        return align > ALIGNMENT ? large_alloc_aligned(align, size, request) : large_alloc(size, request, 0);
+    }
+
+    int grew = 0;
+    pthread_mutex_lock(&a->lock);
+    free_block *block = align > ALIGNMENT ? arena_alloc_aligned(a, align, size, &grew) : arena_alloc(a, size, &grew);
+    if (block) {
+        ((header *)block)->magic = MAGIC_HEAP | (int)(a - arenas);
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    if (grew) {
+        pressure_update(now_ns(), 0);
+    }
+    if (block == NULL) {
+        return NULL;
+    }
+    stats_alloc((header *)block, request);
+    return block + 1;
+}
+
+/**
+ * Shrink an arena block in place, giving its tail back to the arena
+ *
+ * @param a The arena owning the block, locked by the caller
+ * @param block The header of the block
+ * @param size The aligned size wanted, at most the block's size
+ * @return 1 if the block now holds exactly size bytes, 0 if the tail is too small to be a block of its own
+ */
+static int arena_shrink(arena *a, free_block *block, size_t size) {
+    if (block->size == size) {
+        return 1;
+    }
+    if (block->size < size + sizeof(free_block) + ALIGNMENT) {
+        return 0;
+    }
+    free_block *tail = (free_block *)((char *)(block + 1) + size);
+    tail->size = block->size - size - sizeof(free_block);
+    block->size = size;
+    arena_free(a, tail);
+    return 1;
+}
+
+/**
+ * Grow an arena block in place by taking the free block right after it
+ *
+ * Only blocks on the free list are considered, blocks sitting in a
+ * size-class bin or a thread cache are not. Excess beyond the requested
+ * size goes back to the arena. A small size is only reached exactly.
+ *
+ * @param a The arena owning the block, locked by the caller
+ * @param block The header of the block
+ * @param size The aligned size needed
+ * @return 1 if the block now holds size bytes, 0 if it was left untouched
+ */
+static int arena_expand(arena *a, free_block *block, size_t size) {
+    free_block *next = find_next(a, block);
+    if (next == NULL) {
+        return 0;
+    }
+    size_t total = block->size + sizeof(free_block) + next->size;
+    if (total < size || (size <= SMALL_MAX && total == size + sizeof(free_block))) {
+        return 0;
+    }
+
+    remove_free_block(a, next);
+    if (a->zero_spans) {
+        zero_clip(a, next);
+    }
+    block->size = total;
+    arena_shrink(a, block, size);
+    return 1;
+}
+
+/**
+ * Allocates memory with a payload aligned to a given boundary
+ *
+ * The block works with tufree and turealloc like any other. As with
+ * realloc, a block moved by turealloc keeps only the default alignment.
+ * Small requests up to 128-byte alignment are served from the thread
+ * cache like tumalloc's, so freed aligned blocks are reused without a lock.
+ *
+ * @param alignment The alignment, a power of two
+ * @param size The amount of memory to allocate
+ * @return A pointer to the aligned memory, or NULL with errno set to EINVAL or ENOMEM
+ */
+void *tualigned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (alignment <= ALIGNMENT) {
+        return tumalloc(size);
+    }
+    if (!thread_ready) {
+        thread_init();
+    }
+    if (alignment > SIZE_MAX / 4 || size > SIZE_MAX / 2 - 2 * alignment) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    arena *a = &arenas[thread_arena];
+
+    size_t request = size;
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (size == 0) {
+        size = ALIGNMENT;
+    }
+
+    // Freed aligned blocks land in the thread cache, so small requests look there first
+    if (size <= SMALL_MAX && alignment <= (size_t)ALIGNMENT << (ALIGN_LEVELS - 1)) {
+        free_block *block = tcache_pop_aligned(small_class(size), alignment);
+        if (block) {
+            stats_alloc((header *)block, request);
+            TRACE(TRACE_ALIGNED, block + 1, size, (uint32_t)alignment);
+            return block + 1;
+        }
+    }
+
+    void *ptr = arena_malloc(a, alignment, size, request);
+    TRACE(TRACE_ALIGNED, ptr, size, (uint32_t)alignment);
+    if (ptr == NULL) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+/**
+ * Allocates aligned memory, POSIX style
+ *
+ * @param memptr Set to the allocated memory on success
+ * @param alignment The alignment, a power of two multiple of sizeof(void *)
+ * @param size The amount of memory to allocate
+ * @return 0 on success, EINVAL for a bad alignment or ENOMEM
+ */
+int tuposix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *ptr = tualigned_alloc(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+/**
+ * Get the number of bytes usable in an allocated block
+ *
+ * This is at least the requested size, and often more because requests
+ * are rounded up to ALIGNMENT or a size class. All of it may be used.
+ *
+ * @param ptr Pointer to the allocated piece of memory, or NULL
+ * @return The usable size in bytes, 0 for NULL
+ */
+size_t tumalloc_usable_size(void *ptr) {
+    if (!ptr) return 0;
+    return ((header *)ptr - 1)->size;
+}
+
+/**
+ * Allocates memory and reports how much of it is usable
+ *
+ * The reported size counts as the request, so it may be passed to
+ * tufree_sized.
+ *
+ * @param size The minimum amount of memory to allocate
+ * @param actual Set to the usable size of the block, 0 on failure
+ * @return A pointer to the allocated memory or NULL
+ */
+void *tumalloc_at_least(size_t size, size_t *actual) {
+    void *ptr = tumalloc(size);
+    *actual = tumalloc_usable_size(ptr);
+
+    // The caller owns all of it, and may pass it to tufree_sized
+    if (ptr) {
+        stats_slack((header *)ptr - 1, *actual);
+    }
+    return ptr;
+}
+
+/**
+ * Get the size a request is rounded up to
+ *
+ * Asking for the returned size wastes nothing to rounding, and the
+ * returned size is its own good size. A mapped block is exactly that
+ * large; a heap block may still turn out slightly larger when a free block
+ * is too small to split.
+ *
+ * @param size The size a caller wants
+ * @return The smallest size class holding it, or size itself if it is too large to round up
+ */
+size_t tumalloc_good_size(size_t size) {
+    if (size > SIZE_MAX / 2) {
+        return size;
+    }
+    size_t request = size;
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (size == 0) {
+        return ALIGNMENT;
+    }
+    if (size >= opt_mmap_threshold) {
+        size_t len = large_map_len(size);
+        return len ? len - sizeof(header) : request;
+    }
+    return size;
+}
+
+/**
+ * Allocate zeroed memory, the body of tucalloc
+ *
+ * @param num How many elements to allocate
+ * @param size The size of each element
+ * @return A pointer to the zeroed block, or NULL with errno set to ENOMEM
+ */
+static void *do_calloc(size_t num, size_t size) {
+    if (size != 0 && num > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t total_size = num * size;
+    if (total_size > SIZE_MAX / 2) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // Small blocks are cheap to clear and mostly come from the thread cache
+    if (!thread_ready) {
+        thread_init();
+    }
+    arena *a = &arenas[thread_arena];
+    size_t aligned = (total_size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (aligned <= SMALL_MAX) {
+        void *ptr = do_malloc(total_size);
+        if (ptr) {
+            memset(ptr, 0, total_size);  // mem set to 0
+        }
+        return ptr;
+    }
+
+    TRACE(TRACE_CALLOC, NULL, total_size, 0);
+    if (aligned >= opt_mmap_threshold && !a->locked) {
+        return large_alloc(aligned, total_size, 1);
+    }
+
+    int grew = 0;
+    pthread_mutex_lock(&a->lock);
+    free_block *block = arena_alloc(a, aligned, &grew);
+    uintptr_t zero_lo = a->last_zero_lo;
+    uintptr_t zero_hi = a->last_zero_hi;
+    if (block) {
+        ((header *)block)->magic = MAGIC_HEAP | (int)(a - arenas);
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    if (grew) {
+        pressure_update(now_ns(), 0);
+    }
+    if (block == NULL) {
+        return NULL;
+    }
+    stats_alloc((header *)block, total_size);
+
+    // Clear only what is not known to be zero
+    uintptr_t start = (uintptr_t)(block + 1);
+    uintptr_t end = start + total_size;
+    if (zero_lo < start) {
+        zero_lo = start;
+    }
+    if (zero_hi > end) {
+        zero_hi = end;
+    }
+    if (zero_lo >= zero_hi) {
+        memset((void *)start, 0, total_size);
+    } else {
+        memset((void *)start, 0, zero_lo - start);
+        memset((void *)zero_hi, 0, end - zero_hi);
+        calloc_bytes_skipped += zero_hi - zero_lo;
+    }
+    return (void *)start;
+}
+
+/**
+ * Allocates and initializes a list of elements for the end user
+ *
+ * Memory known to be zero is not cleared again: new mappings, memory the
+ * heap just got from sbrk, and free pages purged under memory pressure.
+ *
+ * @param num How many elements to allocate
+ * @param size The size of each element
+ * @return A pointer to the requested block of initialized memory, or NULL with errno set to ENOMEM, also if num * size overflows
+ */
+void *tucalloc(size_t num, size_t size) {
+    PROBE2(calloc_entry, num, size);
+    void *ptr = do_calloc(num, size);
+    PROBE2(calloc_return, ptr, num * size);
+    return ptr;
+}
+
+static void do_free(void *ptr);
+
+/**
+ * Reallocate memory, the untimed body of turealloc
+ *
+ * @param ptr A pointer to an already allocated piece of memory
+ * @param new_size The new requested size to allocate
+ * @return A new pointer containing the contents of ptr, but with the new_size
+ */
+static void *do_realloc(void *ptr, size_t new_size) {
+    if (!ptr) return do_malloc(new_size);  // if null, return to malloc
+    TRACE(TRACE_REALLOC, ptr, new_size, 0);
+    STAT_ADD(thread_stats.nrealloc, 1);
+
+    // snag block header
+    free_block *block = (free_block *)ptr - 1;
+
+    // Mapped blocks that stay large grow or shrink in place of a copy
+    size_t aligned = (new_size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (aligned == 0) {
+        aligned = ALIGNMENT;
+    }
+    int magic = ((header *)block)->magic;
+    if (magic == MAGIC_MMAP && aligned >= opt_mmap_threshold) {
+        return large_realloc((header *)block, aligned, 1);
+    }
+
+    // If current block >, return ptr, but a small size must name the block's class for tufree_sized
+    if (block->size >= new_size) {
+        if (aligned > SMALL_MAX || block->size == aligned) {
+            stats_slack((header *)block, new_size);
+            return ptr;
+        }
+        if (magic != MAGIC_MMAP) {
+            size_t old_size = block->size;
+            arena *a = &arenas[(unsigned)magic & MAGIC_ARENA_MASK];
+            pthread_mutex_lock(&a->lock);
+            int shrunk = arena_shrink(a, block, aligned);
+            pthread_mutex_unlock(&a->lock);
+            if (shrunk) {
+                stats_resize((header *)block, old_size, new_size);
+                return ptr;
+            }
+        }
+    }
+
+    // allocate new block /copy  the data over
+    void *new_ptr = do_malloc(new_size);
+    if (new_ptr) {
+        size_t keep = block->size < new_size ? block->size : new_size;
+        memcpy(new_ptr, ptr, keep);  // Cp data -> new blk
+        realloc_bytes_copied += keep;
+        do_free(ptr);  // Free prev block
+    }
+    return new_ptr;
+}
+
+/**
+ * Reallocates a chunk of memory with a bigger size
+ *
+ * @param ptr A pointer to an already allocated piece of memory
+ * @param new_size The new requested size to allocate
+ * @return A new pointer containing the contents of ptr, but with the new_size
+ */
+void *turealloc(void *ptr, size_t new_size) {
+    PROBE2(realloc_entry, ptr, new_size);
+    LAT_START();
+    void *new_ptr = do_realloc(ptr, new_size);
+    LAT_END(TULAT_REALLOC, new_size);
+    PROBE2(realloc_return, new_ptr, new_size);
+    return new_ptr;
+}
+
+/**
+ * Allocates many blocks of the same size at once
+ *
+ * Small blocks come from the thread cache first. The rest are taken from
+ * the arena under a single lock: from the size-class bin, then by carving
+ * one run big enough for all remaining blocks. Large blocks each get their
+ * own mapping.
+ *
+ * @param size The size of every block
+ * @param count The number of blocks wanted
+ * @param out Filled with pointers to the blocks
+ * @return The number of blocks allocated, less than count only if the OS is out of memory or size is too large
+ */
+size_t tumalloc_batch(size_t size, size_t count, void **out) {
+    if (!thread_ready) {
+        thread_init();
+    }
+    arena *a = &arenas[thread_arena];
+    if (size > SIZE_MAX / 2) {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    size_t request = size;
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (size == 0) {
+        size = ALIGNMENT;
+    }
+
+    size_t n = 0;
+    if (size >= opt_mmap_threshold && !a->locked) {
+        while (n < count && (out[n] = large_alloc(size, request, 0)) != NULL) {
+            n++;
+        }
+        TRACE(TRACE_BATCH, out, size, (uint32_t)n);
+        return n;
+    }
+
+    // Drain the thread cache without refilling it
+    tcache *tc = &thread_cache;
+    size_t cls = small_class(size);
+    if (size <= SMALL_MAX) {
+        while (n < count && tc->count[cls]) {
+            out[n++] = tc->slots[cls][--tc->count[cls]] + 1;
+        }
+    }
+
+    int grew = 0;
+    int magic = MAGIC_HEAP | (int)(a - arenas);
+    pthread_mutex_lock(&a->lock);
+    free_block *block;
+    while (size <= SMALL_MAX && n < count && (block = bin_pop(a, cls, 0)) != NULL) {
+        ((header *)block)->magic = magic;
+        out[n++] = block + 1;
+    }
+
+    // Carve the rest from one run with room for a free block after the last one, falling
+    // back to single blocks if it does not fit, so every block is exactly the size
+    size_t stride = size + sizeof(free_block);
+    size_t left = count - n;
+    free_block *run = NULL;
+    if (left > 1 && left <= (SIZE_MAX - 2 * stride) / stride) {
+        run = arena_alloc(a, left * stride + ALIGNMENT, &grew);
+    }
+    if (run) {
+        char *end = (char *)(run + 1) + run->size;
+        char *p = (char *)run;
+        for (; n < count; p += stride) {
+            block = (free_block *)p;
+            block->size = size;
+            ((header *)block)->magic = magic;
+            out[n++] = block + 1;
+        }
+        block = (free_block *)p;
+        block->size = (size_t)(end - (char *)(block + 1));
+        arena_free(a, block);
+    }
+    while (n < count && (block = arena_alloc(a, size, &grew)) != NULL) {
+        ((header *)block)->magic = magic;
+        out[n++] = block + 1;
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    if (grew) {
+        pressure_update(now_ns(), 0);
+    }
+    for (size_t i = 0; i < n; i++) {
+        stats_alloc((header *)out[i] - 1, request);
+    }
+    TRACE(TRACE_BATCH, out, size, (uint32_t)n);
+    return n;
+}
+
+/**
+ * Removes many used chunks of memory at once
+ *
+ * Heap blocks go straight back to their arena, taking its lock once per
+ * run of pointers from the same arena rather than once per block. Mapped
+ * blocks go to the mapping cache.
+ *
+ * @param ptrs Pointers to allocated pieces of memory, NULL entries are skipped
+ * @param count The number of pointers
+ */
+void tufree_batch(void **ptrs, size_t count) {
+    if (!thread_ready) {
+        thread_init();
+    }
+
+    arena *held = NULL;
+    for (size_t i = 0; i < count; i++) {
+        if (!ptrs[i]) continue;
+
+        header *block = (header *)ptrs[i] - 1;
+        if (block->magic == MAGIC_MMAP) {
+            // Pressure checks in large_free must run without an arena lock
+            if (held) {
+                pthread_mutex_unlock(&held->lock);
+                held = NULL;
+            }
+            large_free(block);
+            continue;
+        }
+
+        stats_free(block);
+        arena *a = &arenas[(unsigned)block->magic & MAGIC_ARENA_MASK];
+        if (a != held) {
+            if (held) {
+                pthread_mutex_unlock(&held->lock);
+            }
+            pthread_mutex_lock(&a->lock);
+            held = a;
+        }
+        arena_free(a, (free_block *)block);
+    }
+    if (held) {
+        pthread_mutex_unlock(&held->lock);
+    }
+    TRACE(TRACE_BATCH_FREE, ptrs, 0, (uint32_t)count);
+}
+
+/**
+ * Allocates memory with per-call flags
+ *
+ * Flags combine TUMALLOCX_LG_ALIGN, TUMALLOCX_ZERO, TUMALLOCX_ARENA and
+ * TUMALLOCX_NOCACHE. Without flags this is exactly tumalloc. Blocks from
+ * another arena are freed back to it by tufree as usual.
+ *
+ * @param size The amount of memory to allocate
+ * @param flags The TUMALLOCX_* flags, or 0
+ * @return A pointer to the allocated memory, or NULL with errno set to EINVAL or ENOMEM
+ */
+void *tumallocx(size_t size, int flags) {
+    if (flags == 0) {
+        return tumalloc(size);
+    }
+    if (!thread_ready) {
+        thread_init();
+    }
+
+    size_t align = (size_t)1 << (flags & TUMALLOCX_LG_ALIGN_MASK);
+    unsigned index = thread_arena;
+    if (flags & TUMALLOCX_ARENA_MASK) {
+        index = (unsigned)((flags & TUMALLOCX_ARENA_MASK) >> TUMALLOCX_ARENA_SHIFT) - 1;
+        pthread_mutex_lock(&arenas_lock);
+        int exists = index < narenas;
+        pthread_mutex_unlock(&arenas_lock);
+        if (!exists) {
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    void *ptr;
+    if (index == thread_arena && !(flags & TUMALLOCX_NOCACHE)) {
+        ptr = align > ALIGNMENT ? tualigned_alloc(align, size) : tumalloc(size);
+    } else {
+        if (align > SIZE_MAX / 4 || size > SIZE_MAX / 2 - 2 * align) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        TRACE(TRACE_MALLOCX, NULL, size, (uint32_t)flags);
+
+        size_t aligned = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        if (aligned == 0) {
+            aligned = ALIGNMENT;
+        }
+        ptr = arena_malloc(&arenas[index], align, aligned, size);
+        if (ptr == NULL) {
+            errno = ENOMEM;
+        }
+    }
+
+    if (ptr && (flags & TUMALLOCX_ZERO)) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+/**
+ * Reallocates memory with per-call flags
+ *
+ * With TUMALLOCX_NOMOVE the block is only resized in place: a mapped
+ * block by remapping without moving, a heap block by taking the free block
+ * after it. If that is not possible NULL is returned and the block is left
+ * as it was. Otherwise a moved block gets its new memory as tumallocx
+ * would with the same flags. TUMALLOCX_ZERO zeroes the bytes past the old
+ * usable size.
+ *
+ * @param ptr A pointer to an already allocated piece of memory, or NULL
+ * @param size The new requested size
+ * @param flags The TUMALLOCX_* flags, or 0
+ * @return A pointer to the resized memory, or NULL if it could not be resized
+ */
+void *turallocx(void *ptr, size_t size, int flags) {
+    if (flags == 0) {
+        return turealloc(ptr, size);
+    }
+    if (!ptr) {
+        return (flags & TUMALLOCX_NOMOVE) ? NULL : tumallocx(size, flags);
+    }
+
+    STAT_ADD(thread_stats.nrealloc, 1);
+    header *block = (header *)ptr - 1;
+    size_t old_size = block->size;
+    size_t align = (size_t)1 << (flags & TUMALLOCX_LG_ALIGN_MASK);
+    size_t aligned = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (aligned < size) {
+        return NULL;
+    }
+    if (aligned == 0) {
+        aligned = ALIGNMENT;
+    }
+    int nomove = (flags & TUMALLOCX_NOMOVE) != 0;
+    int misaligned = ((uintptr_t)ptr & (align - 1)) != 0;
+
+    // Mapped blocks that stay large are remapped; new pages come zeroed from the kernel
+    if (block->magic == MAGIC_MMAP && aligned >= opt_mmap_threshold && !misaligned &&
+        (nomove || align <= (size_t)sysconf(_SC_PAGESIZE))) {
+        return large_realloc(block, aligned, !nomove);
+    }
+
+    // Heap blocks are kept when large enough, as long as a small size still names their class,
+    // otherwise trimmed or grown into a free neighbor
+    if (!misaligned && old_size >= aligned && (block->magic != MAGIC_MMAP || nomove) &&
+        (aligned > SMALL_MAX || old_size == aligned)) {
+        stats_slack(block, size);
+        return ptr;
+    }
+    if (block->magic != MAGIC_MMAP && !misaligned) {
+        arena *a = &arenas[(unsigned)block->magic & MAGIC_ARENA_MASK];
+        pthread_mutex_lock(&a->lock);
+        int resized = old_size >= aligned ? arena_shrink(a, (free_block *)block, aligned)
+                                          : arena_expand(a, (free_block *)block, aligned);
+        pthread_mutex_unlock(&a->lock);
+        if (resized) {
+            stats_resize(block, old_size, size);
+            if ((flags & TUMALLOCX_ZERO) && block->size > old_size) {
+                memset((char *)ptr + old_size, 0, block->size - old_size);
+            }
+            return ptr;
+        }
+    }
+    if (nomove) {
+        return NULL;
+    }
+
+    void *new_ptr = tumallocx(size, flags & ~TUMALLOCX_ZERO);
+    if (new_ptr) {
+        size_t keep = old_size < size ? old_size : size;
+        memcpy(new_ptr, ptr, keep);
+        realloc_bytes_copied += keep;
+        if ((flags & TUMALLOCX_ZERO) && size > keep) {
+            memset((char *)new_ptr + keep, 0, tumalloc_usable_size(new_ptr) - keep);
+        }
+        tufree(ptr);
+    }
+    return new_ptr;
+}
+
+/**
+ * Free memory, the untimed body of tufree
+ *
+ * @param ptr Pointer to the allocated piece of memory
+ */
+static void do_free(void *ptr) {
+    // extra cred next fit test case 
+    TRACE(TRACE_FREE, ptr, 0, 0);
+
+    if (!ptr) return;  // nah, do not free null ptr
+    if (!thread_ready) {
+        thread_init();
+    }
+
+    // Get the block header (before the memory block pointer)
+    free_block *block = (free_block *)ptr - 1;
+
+    // Mapped blocks go to the mapping cache instead of the free list
+    int magic = ((header *)block)->magic;
+    if (magic == MAGIC_MMAP) {
+        large_free((header *)block);
+        TRACE(TRACE_MAP_FREE, ptr, 0, 0);
+        return;
+    }
+
+    // Small blocks of the thread's own arena go to the thread cache
+    stats_free((header *)block);
+    unsigned index = (unsigned)magic & MAGIC_ARENA_MASK;
+    if (block->size <= SMALL_MAX && index == thread_arena) {
+        tcache_push(block, small_class(block->size));
+        TRACE(TRACE_TCACHE_FREE, ptr, block->size, 0);
+        return;
+    }
+
+    // Other heap blocks go back to the arena they came from
+    arena *a = &arenas[index];
+    pthread_mutex_lock(&a->lock);
+    arena_free(a, block);
+    pthread_mutex_unlock(&a->lock);
+}
+
+/**
+ * Removes used chunk of memory and returns it to the free list
+ *
+ * @param ptr Pointer to the allocated piece of memory
+ */
+void tufree(void *ptr) {
+    PROBE1(free_entry, ptr);
+#ifdef TUMALLOC_LATENCY
+    // The header may be gone afterwards, so take the size first
+    if (ptr) {
+        size_t size = ((header *)ptr - 1)->size;
+        LAT_START();
+        do_free(ptr);
+        LAT_END(TULAT_FREE, size);
+        PROBE1(free_return, ptr);
+        EXPORT_TICK();
+        return;
+    }
+#endif
+    do_free(ptr);
+    PROBE1(free_return, ptr);
+    EXPORT_TICK();
+}
+
+/**
+ * Removes used chunk of memory whose size the caller knows
+ *
+ * Small blocks are always carved at exactly their size class, so the size
+ * passed names the thread cache class and the statistics to take off.
+ * While the main heap is the only arena and no block is sampled by the
+ * profiler, the block header is not read at all, which saves a cache miss
+ * on cold objects. Everything else takes the tufree path. Building with
+ * TUMALLOC_DEBUG checks the size against the header and aborts on a
+ * mismatch.
+ *
+ * @param ptr Pointer to the allocated piece of memory
+ * @param size The size passed when allocating or last reallocating it, or the size tumalloc_at_least reported
+ */
+void tufree_sized(void *ptr, size_t size) {
+    if (!ptr) return;
+
+    free_block *block = (free_block *)ptr - 1;
+    size_t request = size;
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (size == 0) {
+        size = ALIGNMENT;
+    }
+
+#ifdef TUMALLOC_DEBUG
+    // Small blocks are exactly their class and remember the request, larger ones hold at least it
+    header *h = (header *)block;
+    if (h->magic != MAGIC_MMAP && (size <= SMALL_MAX ? h->size != size || h->slack != size - request
+                                                     : h->size < size)) {
+        fprintf(stderr, "tufree_sized: %p has %zu bytes for %zu, caller claims %zu\n", ptr, h->size,
+                h->size - h->slack, request);
+        abort();
+    }
+#endif
+
+    // With one arena every small block belongs to the main heap, which is the thread's arena
+    if (size <= SMALL_MAX && thread_ready && narenas == 1 && !prof_tracked) {
+        TRACE(TRACE_FREE, ptr, size, 0);
+        stats_bytes(size, size + sizeof(header), -1);
+        stats_arena(0, size, size - request, -1);
+        STAT_ADD(thread_stats.nfree, 1);
+        tcache_push(block, small_class(size));
+        TRACE(TRACE_TCACHE_FREE, ptr, size, 0);
+        return;
+    }
+    tufree(ptr);
 }
 
@@ -2,6 +2,7 @@
 #define CYB3053_PROJECT2_ALLOC_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 /**
  * Header for allocated blocks
@@ -9,6 +10,8 @@
 typedef struct header {
     size_t size; /**< Size of the block */
     int magic; /**< Magic number for error checking */
+    uint16_t slack; /**< Usable bytes beyond the request of a live arena block, for tumalloc_frag */
+    uint16_t flags; /**< Allocator flags of a live block, such as whether the heap profiler tracks it */
 } header;
 
 /**
@@ -19,10 +22,132 @@ typedef struct free_block {
     struct free_block *next; /**< Pointer to the next free block */
 } free_block;
 
+#define TUPREWARM_TOUCH 0x1 /**< Fault the reservation in by writing to every page */
+#define TUPREWARM_POPULATE 0x2 /**< Fault the reservation in with MADV_POPULATE_WRITE, touching pages if unsupported */
+#define TUPREWARM_THREADS 0x4 /**< Spread touching over several threads */
+#define TUPREWARM_SEED 0x8 /**< Carve half of the reservation into blocks for the size-class bins */
+
+#define TUMALLOCX_LG_ALIGN(la) ((int)(la)) /**< Align the payload to 1 << la bytes */
+#define TUMALLOCX_LG_ALIGN_MASK 0x3f /**< Bits of the flags holding the lg alignment */
+#define TUMALLOCX_ZERO 0x40 /**< Zero the new memory */
+#define TUMALLOCX_NOCACHE 0x80 /**< Take the block from the arena, not the thread cache */
+#define TUMALLOCX_NOMOVE 0x100 /**< Resize in place or fail, for turallocx */
+#define TUMALLOCX_ARENA_SHIFT 12 /**< Position of the arena index in the flags */
+#define TUMALLOCX_ARENA_MASK (0xff << TUMALLOCX_ARENA_SHIFT) /**< Bits of the flags holding the arena index plus one */
+#define TUMALLOCX_ARENA(a) ((int)(((a) + 1) << TUMALLOCX_ARENA_SHIFT)) /**< Allocate from arena a instead of the thread's arena */
+
+#define TUSTATS_SMALL_CLASSES 32 /**< Number of small size classes, 16 bytes apart */
+#define TUSTATS_LARGE_BUCKETS 160 /**< Number of size buckets for blocks above the small classes, four per power of two */
+#define TUSTATS_SEARCH_BUCKETS 16 /**< Number of free-list search depth buckets, powers of two apart */
+
+#define TULAT_MALLOC 0 /**< Latency of tumalloc */
+#define TULAT_FREE 1 /**< Latency of tufree */
+#define TULAT_REALLOC 2 /**< Latency of turealloc */
+#define TULAT_OPS 3 /**< Number of timed operations */
+
+#define TULAT_SMALL 0 /**< Requests served from the size-class bins */
+#define TULAT_MEDIUM 1 /**< Larger requests carved from an arena */
+#define TULAT_LARGE 2 /**< Requests at or above the mmap threshold */
+#define TULAT_SIZES 3 /**< Number of size groups timed separately */
+
+/**
+ * Latency summary of one operation and size group
+ *
+ * Percentiles are the upper bound of the histogram bucket they fall in,
+ * which is at most a quarter above the true value.
+ */
+typedef struct tulatency {
+    size_t count; /**< Calls timed */
+    uint64_t p50; /**< Median latency in ns */
+    uint64_t p99; /**< 99th percentile latency in ns */
+    uint64_t p999; /**< 99.9th percentile latency in ns */
+    uint64_t max; /**< Slowest call in ns */
+} tulatency;
+
+/**
+ * Fragmentation of one arena
+ *
+ * All values are kept up to date as blocks come and go, so reading them
+ * does not walk the heap. Mapped blocks belong to no arena and are not
+ * included.
+ */
+typedef struct tufrag {
+    size_t footprint; /**< Bytes the arena got from the OS */
+    size_t free_bytes; /**< Usable bytes of the free blocks on the free list and in the size-class bins */
+    size_t free_blocks; /**< Number of those blocks */
+    size_t largest_free; /**< Size of the largest free block, rounded down by at most a quarter */
+    double external; /**< External fragmentation, 1 - largest_free / free_bytes, 0 with no free bytes */
+    size_t live_blocks; /**< Blocks handed out and not freed */
+    size_t header_bytes; /**< Bytes of the headers of those blocks */
+    size_t rounding_bytes; /**< Usable bytes of those blocks beyond what was asked for */
+    size_t metadata_bytes; /**< Headers of the free blocks plus the arena's own bookkeeping */
+    size_t cached_bytes; /**< Freed blocks held by thread caches, what is left of the footprint */
+} tufrag;
+
+/**
+ * Allocator statistics
+ */
+typedef struct tustats {
+    size_t large_cache_hits; /**< Large allocations served from the mapping cache */
+    size_t large_cache_misses; /**< Large allocations that needed a new mapping */
+    size_t large_cache_bytes; /**< Bytes currently held in the mapping cache */
+    size_t large_cache_mappings; /**< Mappings currently held in the mapping cache */
+    size_t realloc_remaps; /**< Reallocations done by remapping pages instead of copying */
+    size_t realloc_bytes_copied; /**< Payload bytes copied by turealloc */
+    int pressure_level; /**< Memory pressure level, from 0 (none) to 3 (critical) */
+    size_t purged_bytes; /**< Free heap bytes returned to the OS under pressure */
+    size_t calloc_bytes_skipped; /**< Bytes tucalloc did not clear because they were known to be zero */
+    size_t locked_bytes; /**< Bytes of locked arenas pinned in memory */
+    size_t unpinned_bytes; /**< Bytes of locked arenas that could not be pinned, e.g. due to RLIMIT_MEMLOCK */
+    size_t allocated; /**< Usable bytes of live blocks */
+    size_t active; /**< Bytes of live blocks including headers, whole mappings for mapped blocks */
+    size_t mapped; /**< Bytes obtained from the OS with sbrk and mmap and not unmapped */
+    size_t retained; /**< Mapped bytes not in live blocks: free lists, bins, thread caches and cached mappings */
+    size_t nmalloc; /**< Blocks handed out, by any allocation call */
+    size_t nfree; /**< Blocks released, by any free call */
+    size_t nrealloc; /**< Calls to turealloc and turallocx with a block */
+    size_t tcache_hits; /**< Small allocations served by the thread cache without a lock */
+    size_t tcache_misses; /**< Small allocations that had to take the arena lock */
+    size_t small_live[TUSTATS_SMALL_CLASSES]; /**< Live small blocks by size class, class i holding 16 * (i + 1) bytes */
+    size_t large_live[TUSTATS_LARGE_BUCKETS]; /**< Live larger blocks by size, bucket i starting at (4 + i % 4) << (i / 4 + 7) bytes */
+    size_t large_live_bytes[TUSTATS_LARGE_BUCKETS]; /**< Usable bytes of those blocks, by the same buckets */
+    size_t search_depth[TUSTATS_SEARCH_BUCKETS]; /**< Free-list searches by blocks visited: bucket 0 for none, bucket i for 2^(i-1) up to 2^i - 1, the last bucket for more */
+    size_t search_visited; /**< Free blocks visited by all searches, for the mean depth */
+    size_t search_hits; /**< Searches that found a fitting block */
+    size_t search_misses; /**< Searches that found none and fell back to growing the heap with sbrk or mmap */
+    size_t fit_wasted_bytes; /**< Bytes handed out beyond the request because the fitting block was too small to split */
+    tulatency latency[TULAT_OPS][TULAT_SIZES]; /**< Latency by operation and size group, all zero unless built with TUMALLOC_LATENCY */
+} tustats;
+
 void *tumalloc(size_t size);
 void *tucalloc(size_t num, size_t size);
 void *turealloc(void *ptr, size_t new_size);
 void tufree(void *ptr);
+void tufree_sized(void *ptr, size_t size);
+size_t tumalloc_batch(size_t size, size_t count, void **out);
+void tufree_batch(void **ptrs, size_t count);
+size_t tumalloc_usable_size(void *ptr);
+void *tumalloc_at_least(size_t size, size_t *actual);
+size_t tumalloc_good_size(size_t size);
+void *tumallocx(size_t size, int flags);
+void *turallocx(void *ptr, size_t size, int flags);
+void *tualigned_alloc(size_t alignment, size_t size);
+int tuposix_memalign(void **memptr, size_t alignment, size_t size);
+void tumalloc_stats(tustats *stats);
+int tumalloc_frag(unsigned index, tufrag *frag);
+int tumalloc_prof_dump(const char *path);
+int tumalloc_snapshot(const char *path);
+size_t tumalloc_prof_dropped(void);
+int tumalloc_trace_dump(const char *path);
+int tumalloc_stats_export(const char *path);
+int tumalloc_report(const char *path);
+int tumalloc_report_on_signal(int signo, const char *path);
+int tumallctl(const char *name, void *oldp, size_t *oldlenp, void *newp, size_t newlen);
+int tumalloc_prewarm(size_t bytes, int flags);
+int tuarena_create_locked(size_t reserve);
+int tuarena_bind(unsigned index);
+int tumalloc_pressure_update(void);
+void tumalloc_set_cgroup_paths(const char *dir, const char *psi);
 
 #endif //CYB3053_PROJECT2_ALLOC_H
 
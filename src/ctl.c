@@ -0,0 +1,377 @@
+#include "alloc.h"
+#include "ctl.h"
+#include "export.h"
+#include "pressure.h"
+#include "prof.h"
+#include "report.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * A numeric tunable
+ */
+typedef struct ctl_opt {
+    const char *name; /**< Name passed to tumallctl */
+    _Atomic size_t *value; /**< The variable the allocator reads */
+    size_t min; /**< Smallest accepted value */
+    size_t max; /**< Largest accepted value */
+} ctl_opt;
+
+/**
+ * A statistic read from tumalloc_stats
+ */
+typedef struct ctl_stat {
+    const char *name; /**< Name passed to tumallctl */
+    size_t offset; /**< Offset of the field in tustats */
+    size_t len; /**< Size of the field */
+} ctl_stat;
+
+#define CTL_STAT(field) {"stats." #field, offsetof(tustats, field), sizeof(((tustats *)0)->field)}
+
+static const ctl_opt ctl_opts[] = {
+    {"opt.mmap_threshold", &opt_mmap_threshold, MMAP_THRESHOLD_MIN, SIZE_MAX / 4},
+    {"opt.large_cache_max_bytes", &opt_large_cache_max_bytes, 0, SIZE_MAX},
+    {"opt.large_cache_decay_ms", &opt_large_cache_decay_ms, 0, UINT32_MAX},
+    {"opt.tcache_slots", &opt_tcache_slots, 1, TCACHE_SLOTS},
+    {"opt.purge_level", &opt_purge_level, 0, PRESSURE_LEVELS},
+    {"opt.prof", &opt_prof, 0, 1},
+    {"opt.prof_sample", &opt_prof_sample, 1, SIZE_MAX / 4},
+    {"opt.export_ms", &opt_export_ms, 0, UINT32_MAX},
+    {"opt.report_signal", &opt_report_signal, 1, NSIG - 1},
+};
+
+static const ctl_stat ctl_stats[] = {
+    CTL_STAT(large_cache_hits),
+    CTL_STAT(large_cache_misses),
+    CTL_STAT(large_cache_bytes),
+    CTL_STAT(large_cache_mappings),
+    CTL_STAT(realloc_remaps),
+    CTL_STAT(realloc_bytes_copied),
+    CTL_STAT(pressure_level),
+    CTL_STAT(purged_bytes),
+    CTL_STAT(calloc_bytes_skipped),
+    CTL_STAT(locked_bytes),
+    CTL_STAT(unpinned_bytes),
+    CTL_STAT(allocated),
+    CTL_STAT(active),
+    CTL_STAT(mapped),
+    CTL_STAT(retained),
+    CTL_STAT(nmalloc),
+    CTL_STAT(nfree),
+    CTL_STAT(nrealloc),
+    CTL_STAT(tcache_hits),
+    CTL_STAT(tcache_misses),
+    CTL_STAT(small_live),
+    CTL_STAT(large_live),
+    CTL_STAT(large_live_bytes),
+    CTL_STAT(search_depth),
+    CTL_STAT(search_visited),
+    CTL_STAT(search_hits),
+    CTL_STAT(search_misses),
+    CTL_STAT(fit_wasted_bytes),
+};
+
+static const char *const fit_names[] = {"next", "first", "best"}; /**< Values of opt.fit, by FIT_* index */
+
+/**
+ * Copy a value out and take a new one in, checking the lengths
+ *
+ * @param value The current value
+ * @param len The size of the value
+ * @param oldp Where to copy the current value, or NULL
+ * @param oldlenp Must point to len when oldp is given
+ * @param newp The new value, or NULL to only read
+ * @param newlen Must be len when newp is given
+ * @param writable Whether the value may be set
+ * @return 0 on success, EINVAL for a wrong length, EPERM when setting a read-only value
+ */
+static int ctl_copy(const void *value, size_t len, void *oldp, size_t *oldlenp,
+                    const void *newp, size_t newlen, int writable) {
+    if (oldp && (oldlenp == NULL || *oldlenp != len)) {
+        return EINVAL;
+    }
+    if (newp && !writable) {
+        return EPERM;
+    }
+    if (newp && newlen != len) {
+        return EINVAL;
+    }
+    if (oldp) {
+        memcpy(oldp, value, len);
+    }
+    return 0;
+}
+
+/**
+ * Handle arena.<i>.<command> and arena.<i>.<value>
+ *
+ * @param name The part of the name after "arena."
+ * @param oldp Receives the current value, or NULL
+ * @param oldlenp Points to the size of *oldp
+ * @param newp Must be NULL, arena values are read-only
+ * @param newlen The size of *newp
+ * @return 0 on success, ENOENT for an unknown arena or command, or an error of ctl_copy
+ */
+static int ctl_arena(const char *name, void *oldp, size_t *oldlenp, const void *newp, size_t newlen) {
+    char *end;
+    unsigned long index = strtoul(name, &end, 10);
+    if (end == name || index >= arena_count()) {
+        return ENOENT;
+    }
+    if (strcmp(end, ".purge") == 0) {
+        arena_purge((unsigned)index);
+        return 0;
+    }
+    if (strcmp(end, ".frag") == 0) {
+        tufrag frag;
+        tumalloc_frag((unsigned)index, &frag);
+        return ctl_copy(&frag, sizeof(frag), oldp, oldlenp, newp, newlen, 0);
+    }
+    return ENOENT;
+}
+
+/**
+ * Parse a size with an optional k, m or g suffix
+ *
+ * @param text The value, not NUL-terminated
+ * @param len The length of the value
+ * @param value Set to the parsed size
+ * @return 0 on success, -1 if the value is not a size
+ */
+static int conf_size(const char *text, size_t len, size_t *value) {
+    size_t i = 0;
+    size_t result = 0;
+    while (i < len && text[i] >= '0' && text[i] <= '9') {
+        size_t digit = (size_t)(text[i++] - '0');
+        if (result > (SIZE_MAX - digit) / 10) {
+            return -1;
+        }
+        result = result * 10 + digit;
+    }
+    if (i == 0) {
+        return -1;
+    }
+
+    unsigned shift = 0;
+    if (i + 1 == len) {
+        switch (text[i++]) {
+            case 'k': case 'K': shift = 10; break;
+            case 'm': case 'M': shift = 20; break;
+            case 'g': case 'G': shift = 30; break;
+            default: return -1;
+        }
+    }
+    if (i != len || result > SIZE_MAX >> shift) {
+        return -1;
+    }
+    *value = result << shift;
+    return 0;
+}
+
+/**
+ * Check whether a name that is not NUL-terminated equals a string
+ *
+ * @param name The name
+ * @param len The length of the name
+ * @param expected The string to compare with
+ * @return 1 if they are equal
+ */
+static int conf_is(const char *name, size_t len, const char *expected) {
+    return strlen(expected) == len && strncmp(name, expected, len) == 0;
+}
+
+/**
+ * Apply one TUMALLOC_CONF option
+ *
+ * @param name The option name, not NUL-terminated
+ * @param name_len The length of the name
+ * @param value The option value, not NUL-terminated
+ * @param value_len The length of the value
+ * @return 0 on success, -1 for an unknown option or a bad value
+ */
+static int conf_apply(const char *name, size_t name_len, const char *value, size_t value_len) {
+    if (conf_is(name, name_len, "fit")) {
+        for (int fit = 0; fit < (int)(sizeof(fit_names) / sizeof(fit_names[0])); fit++) {
+            if (conf_is(value, value_len, fit_names[fit])) {
+                opt_fit = fit;
+                return 0;
+            }
+        }
+        return -1;
+    }
+    if (conf_is(name, name_len, "export")) {
+        return export_conf(value, value_len);
+    }
+    if (conf_is(name, name_len, "report")) {
+        return report_conf(value, value_len);
+    }
+
+    size_t number;
+    if (conf_size(value, value_len, &number) != 0) {
+        return -1;
+    }
+    if (conf_is(name, name_len, "arenas")) {
+        if (number < 1 || number > CONF_ARENAS_MAX) {
+            return -1;
+        }
+        opt_arenas = number;
+        return 0;
+    }
+    if (conf_is(name, name_len, "decay_ms")) {
+        name = "large_cache_decay_ms";
+        name_len = strlen(name);
+    }
+
+    // Everything else is an opt.* tunable without its prefix
+    for (size_t i = 0; i < sizeof(ctl_opts) / sizeof(ctl_opts[0]); i++) {
+        const ctl_opt *opt = &ctl_opts[i];
+        if (!conf_is(name, name_len, opt->name + 4)) continue;
+
+        if (number < opt->min || number > opt->max) {
+            return -1;
+        }
+        *opt->value = number;
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * Apply a TUMALLOC_CONF string
+ *
+ * Options are separated by commas, each a name and a value separated by a
+ * colon, as in "arenas:8,mmap_threshold:256k,decay_ms:5000". Names are
+ * those of the opt.* tunables without the prefix, plus arenas,
+ * decay_ms, export, whose value is the path of a stats segment to
+ * publish to as with tumalloc_stats_export, and report, the path
+ * tumalloc_report_on_signal appends to on opt.report_signal. Sizes take an optional k, m or g suffix. Bad options are
+ * reported on stderr and skipped. Nothing is allocated, so this can run
+ * inside the first tumalloc call.
+ *
+ * @param conf The string, or NULL if the variable is unset
+ */
+void ctl_conf(const char *conf) {
+    if (conf == NULL) return;
+
+    const char *p = conf;
+    while (*p) {
+        const char *name = p;
+        size_t name_len = strcspn(p, ":,");
+        const char *value = p + name_len;
+        size_t value_len = 0;
+        int ok = *value == ':';
+        if (ok) {
+            value++;
+            value_len = strcspn(value, ",");
+        }
+        p = value + value_len;
+
+        if (!ok || conf_apply(name, name_len, value, value_len) != 0) {
+            fprintf(stderr, "tumalloc: ignoring TUMALLOC_CONF option \"%.*s\"\n", (int)(p - name), name);
+        }
+        if (*p == ',') {
+            p++;
+        }
+    }
+}
+
+/**
+ * Read statistics and read or change tunables by name
+ *
+ * Numeric values are size_t, except stats.pressure_level which is an int,
+ * stats.small_live, stats.large_live, stats.large_live_bytes and
+ * stats.search_depth which are arrays of TUSTATS_SMALL_CLASSES,
+ * TUSTATS_LARGE_BUCKETS and TUSTATS_SEARCH_BUCKETS size_t,
+ * arena.<i>.frag which is a tufrag, arenas.narenas which is an unsigned,
+ * and opt.fit which is a const char * naming the free-list search policy:
+ * "next", "first" or "best". Commands such as arena.<i>.purge take no
+ * values, except prof.dump whose newp points to the const char * path to
+ * write the heap profile to. Tunables take effect for the next allocation or release;
+ * opt.arenas can only be set by TUMALLOC_CONF, and ALIGNMENT and the block
+ * layout are fixed.
+ *
+ * @param name The name, such as "opt.mmap_threshold" or "arena.0.purge"
+ * @param oldp Receives the current value, or NULL
+ * @param oldlenp Points to the size of *oldp, which must match the value's size
+ * @param newp Points to a new value to set, or NULL
+ * @param newlen The size of *newp
+ * @return 0 on success, ENOENT for an unknown name, EINVAL for a bad length or value, EPERM for a read-only value
+ */
+int tumallctl(const char *name, void *oldp, size_t *oldlenp, void *newp, size_t newlen) {
+    if (name == NULL) {
+        return ENOENT;
+    }
+    conf_init();
+
+    for (size_t i = 0; i < sizeof(ctl_opts) / sizeof(ctl_opts[0]); i++) {
+        const ctl_opt *opt = &ctl_opts[i];
+        if (strcmp(name, opt->name) != 0) continue;
+
+        size_t value = *opt->value;
+        int err = ctl_copy(&value, sizeof(value), oldp, oldlenp, newp, newlen, 1);
+        if (err || newp == NULL) {
+            return err;
+        }
+        memcpy(&value, newp, sizeof(value));
+        if (value < opt->min || value > opt->max) {
+            return EINVAL;
+        }
+        *opt->value = value;
+        return 0;
+    }
+
+    if (strcmp(name, "opt.fit") == 0) {
+        const char *current = fit_names[opt_fit];
+        int err = ctl_copy(&current, sizeof(current), oldp, oldlenp, newp, newlen, 1);
+        if (err || newp == NULL) {
+            return err;
+        }
+        const char *wanted;
+        memcpy(&wanted, newp, sizeof(wanted));
+        for (int fit = 0; fit < (int)(sizeof(fit_names) / sizeof(fit_names[0])); fit++) {
+            if (wanted && strcmp(wanted, fit_names[fit]) == 0) {
+                opt_fit = fit;
+                return 0;
+            }
+        }
+        return EINVAL;
+    }
+
+    if (strncmp(name, "stats.", 6) == 0) {
+        for (size_t i = 0; i < sizeof(ctl_stats) / sizeof(ctl_stats[0]); i++) {
+            const ctl_stat *stat = &ctl_stats[i];
+            if (strcmp(name, stat->name) != 0) continue;
+
+            tustats stats;
+            tumalloc_stats(&stats);
+            return ctl_copy((char *)&stats + stat->offset, stat->len, oldp, oldlenp, newp, newlen, 0);
+        }
+        return ENOENT;
+    }
+
+    if (strcmp(name, "opt.arenas") == 0) {
+        size_t arenas = opt_arenas;
+        return ctl_copy(&arenas, sizeof(arenas), oldp, oldlenp, newp, newlen, 0);
+    }
+
+    // Commands with an argument take it through newp
+    if (strcmp(name, "prof.dump") == 0) {
+        if (oldp || newp == NULL || newlen != sizeof(const char *)) {
+            return EINVAL;
+        }
+        return tumalloc_prof_dump(*(const char *const *)newp) == 0 ? 0 : EIO;
+    }
+
+    if (strcmp(name, "arenas.narenas") == 0) {
+        unsigned count = arena_count();
+        return ctl_copy(&count, sizeof(count), oldp, oldlenp, newp, newlen, 0);
+    }
+
+    if (strncmp(name, "arena.", 6) == 0) {
+        return ctl_arena(name + 6, oldp, oldlenp, newp, newlen);
+    }
+    return ENOENT;
+}
@@ -0,0 +1,27 @@
+#ifndef CYB3053_PROJECT2_CTL_H
+#define CYB3053_PROJECT2_CTL_H
+
+#include <stddef.h>
+
+#define TCACHE_SLOTS 32 /**< Blocks a thread can cache per size class, opt.tcache_slots is at most this */
+#define MMAP_THRESHOLD_MIN (4 * 1024) /**< Smallest value accepted for opt.mmap_threshold */
+#define CONF_ARENAS_MAX 32 /**< Most heap arenas TUMALLOC_CONF may ask for, leaving room for locked arenas */
+
+#define FIT_NEXT 0 /**< Resume the free-list search where the last one stopped */
+#define FIT_FIRST 1 /**< Take the first block large enough, searching from the head */
+#define FIT_BEST 2 /**< Take the smallest block large enough */
+
+extern _Atomic size_t opt_mmap_threshold;
+extern _Atomic size_t opt_large_cache_max_bytes;
+extern _Atomic size_t opt_large_cache_decay_ms;
+extern _Atomic size_t opt_tcache_slots;
+extern _Atomic size_t opt_purge_level;
+extern _Atomic int opt_fit;
+extern _Atomic size_t opt_arenas;
+
+void conf_init(void);
+void ctl_conf(const char *conf);
+unsigned arena_count(void);
+void arena_purge(unsigned index);
+
+#endif //CYB3053_PROJECT2_CTL_H
@@ -0,0 +1,170 @@
+#define _GNU_SOURCE /**< For memfd_create */
+
+#include "alloc.h"
+#include "export.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+_Atomic size_t opt_export_ms = EXPORT_MS; /**< Least time between two publishes in ms */
+_Atomic int export_live = 0; /**< Whether calls should check for a due publish */
+_Thread_local unsigned export_countdown = 0; /**< Calls of the thread, a check every EXPORT_EVERY */
+
+static pthread_mutex_t export_lock = PTHREAD_MUTEX_INITIALIZER; /**< Held by the thread publishing */
+static export_page *export_seg = NULL; /**< The mapped segment, NULL until exporting starts */
+static _Atomic uint64_t export_next = 0; /**< Monotonic time in ns before which no publish is due */
+static char export_path[EXPORT_PATH_MAX]; /**< Segment TUMALLOC_CONF asked for, opened on the first check */
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in nanoseconds
+ */
+static uint64_t export_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Copy the current stats into the segment
+ *
+ * The stats are gathered first, so the seqlock is only odd for the copy.
+ * Called with export_lock held.
+ */
+static void export_publish(void) {
+    tustats stats;
+    tumalloc_stats(&stats);
+
+    uint64_t seq = atomic_load_explicit(&export_seg->seq, memory_order_relaxed);
+    atomic_store_explicit(&export_seg->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&export_seg->stats, &stats, sizeof(stats));
+    export_seg->published_ns = export_now();
+    export_seg->publishes++;
+    atomic_store_explicit(&export_seg->seq, seq + 2, memory_order_release);
+}
+
+/**
+ * Create and map the segment
+ *
+ * Called with export_lock held.
+ *
+ * @param path The file to create, or NULL for an anonymous memfd
+ * @return The segment's file descriptor, or -1 with errno set
+ */
+static int export_open(const char *path) {
+    int fd = path ? open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : memfd_create("tumalloc-stats", MFD_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(export_page)) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    export_page *seg = mmap(NULL, sizeof(export_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (seg == MAP_FAILED) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+
+    seg->version = EXPORT_VERSION;
+    seg->page_size = sizeof(export_page);
+    seg->stats_size = sizeof(tustats);
+    seg->pid = (uint64_t)getpid();
+    export_seg = seg;
+    export_publish();
+
+    // Readers check the magic last, so they never see a half-made segment
+    atomic_thread_fence(memory_order_release);
+    seg->magic = EXPORT_MAGIC;
+    export_next = export_now() + opt_export_ms * 1000000u;
+    return fd;
+}
+
+/**
+ * Publish the stats if opt.export_ms has passed since the last publish
+ *
+ * Called through EXPORT_TICK from tumalloc and tufree, without any lock
+ * held. Only the clock is read unless a publish is due, and a thread that
+ * finds another one publishing leaves it to that one. A segment set by
+ * TUMALLOC_CONF is created here on the first check.
+ */
+void export_tick(void) {
+    uint64_t now = export_now();
+    if (now < export_next || pthread_mutex_trylock(&export_lock) != 0) {
+        return;
+    }
+    if (export_seg == NULL) {
+        if (export_open(export_path) < 0) {
+            export_live = 0;
+        }
+    } else if (now >= export_next) {
+        export_next = now + opt_export_ms * 1000000u;
+        export_publish();
+    }
+    pthread_mutex_unlock(&export_lock);
+}
+
+/**
+ * Remember a segment path from TUMALLOC_CONF
+ *
+ * Nothing is opened yet, as the configuration is loaded inside the first
+ * allocation.
+ *
+ * @param path The path, not NUL-terminated
+ * @param len The length of the path
+ * @return 0 on success, -1 if the path is empty or too long or exporting already started
+ */
+int export_conf(const char *path, size_t len) {
+    if (len == 0 || len >= EXPORT_PATH_MAX || export_live) {
+        return -1;
+    }
+    memcpy(export_path, path, len);
+    export_path[len] = '\0';
+    export_live = 1;
+    return 0;
+}
+
+/**
+ * Start publishing the allocator statistics into shared memory
+ *
+ * The segment holds an export_page: a versioned header and a tustats
+ * behind a seqlock, so another process can map it read-only and take
+ * consistent snapshots, e.g. with the tustat tool, without calling into
+ * this one. tumalloc and tufree republish it at most every opt.export_ms,
+ * checking the clock once every EXPORT_EVERY calls of a thread, so the
+ * numbers lag by about that much and stay put while the process does not
+ * allocate. The segment is also published once here.
+ *
+ * With a path, such as "/dev/shm/app.tustats", the segment is that file.
+ * Without one it is an anonymous memfd, which a reader can open as
+ * /proc/<pid>/fd/<fd>. Setting export:<path> in TUMALLOC_CONF does the
+ * same as calling this with the path.
+ *
+ * @param path The file to create, or NULL for a memfd
+ * @return The segment's file descriptor, owned by the allocator, or -1
+ *         with errno set, to EBUSY if the process is already exporting
+ */
+int tumalloc_stats_export(const char *path) {
+    pthread_mutex_lock(&export_lock);
+    if (export_seg != NULL) {
+        pthread_mutex_unlock(&export_lock);
+        errno = EBUSY;
+        return -1;
+    }
+    int fd = export_open(path);
+    if (fd >= 0) {
+        export_live = 1;
+    }
+    pthread_mutex_unlock(&export_lock);
+    return fd;
+}
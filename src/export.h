@@ -0,0 +1,50 @@
+#ifndef CYB3053_PROJECT2_EXPORT_H
+#define CYB3053_PROJECT2_EXPORT_H
+
+#include "alloc.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define EXPORT_MAGIC 0x54535554u /**< "TUST" in memory on little-endian machines, the first word of a stats segment */
+#define EXPORT_VERSION 1 /**< Layout version of export_page, bumped on any change */
+#define EXPORT_MS 100 /**< Default for opt.export_ms: least time between two publishes */
+#define EXPORT_EVERY 256 /**< Calls of a thread between two checks whether a publish is due */
+#define EXPORT_PATH_MAX 256 /**< Longest segment path TUMALLOC_CONF may give */
+
+/**
+ * The shared stats segment, mapped by the process and by readers
+ *
+ * The process updates stats under a seqlock: seq is odd while it writes.
+ * A reader copies stats between two reads of seq and keeps the copy if
+ * both were the same even number.
+ */
+typedef struct export_page {
+    uint32_t magic; /**< EXPORT_MAGIC */
+    uint32_t version; /**< EXPORT_VERSION */
+    uint32_t page_size; /**< sizeof(export_page) of the writer */
+    uint32_t stats_size; /**< sizeof(tustats) of the writer */
+    uint64_t pid; /**< The publishing process */
+    _Atomic uint64_t seq; /**< Seqlock sequence, odd during an update */
+    uint64_t published_ns; /**< CLOCK_MONOTONIC time of the last publish */
+    uint64_t publishes; /**< Number of publishes so far */
+    tustats stats; /**< The counters, as tumalloc_stats returns them */
+} export_page;
+
+extern _Atomic size_t opt_export_ms;
+extern _Atomic int export_live;
+extern _Thread_local unsigned export_countdown;
+
+void export_tick(void);
+int export_conf(const char *path, size_t len);
+
+/**
+ * Publish the stats if exporting and a publish is due, checked every EXPORT_EVERY calls
+ */
+#define EXPORT_TICK()                                                    \
+    do {                                                                 \
+        if (export_live && ++export_countdown % EXPORT_EVERY == 0) {     \
+            export_tick();                                               \
+        }                                                                \
+    } while (0)
+
+#endif //CYB3053_PROJECT2_EXPORT_H
@@ -0,0 +1,152 @@
+#include "alloc.h"
+#include "list.h"
+
+#include <stdio.h>
+
+/**
+ * Allocate a node with tumalloc
+ *
+ * @param ctx Unused
+ * @param size The node size
+ * @return The node, or NULL if the allocation failed
+ */
+static void *heap_alloc(void *ctx, size_t size) {
+    (void)ctx;
+    return tumalloc(size);
+}
+
+/**
+ * Free a node with tufree
+ *
+ * @param ctx Unused
+ * @param ptr The node
+ */
+static void heap_release(void *ctx, void *ptr) {
+    (void)ctx;
+    tufree(ptr);
+}
+
+const list_allocator list_heap = {heap_alloc, heap_release, NULL}; /**< Nodes from tumalloc and tufree */
+
+/**
+ * Create a new list with a single element
+ *
+ * @param a The allocator to take the node from
+ * @param data The data to store in the list
+ * @return A pointer to the new list
+ */
+node *list_new(const list_allocator *a, int data) {
+    // Allocate memory for the list
+    node *list = (node *)a->alloc(a->ctx, sizeof(node));
+
+    // Check if the allocation was successful
+    if (list == NULL) {
+        return NULL;
+    }
+
+    // Initialize the list
+    list->next = NULL;
+    list->data = data;
+
+    return list;
+}
+
+/**
+ * Add a new element to the end of the list
+ *
+ * @param a The allocator to take the node from
+ * @param list The list to add to, or any element of it, such as the last one
+ * @param data The data to store in the new element
+ * @return The new element, or NULL if the allocation failed
+ */
+node *list_add(const list_allocator *a, node *list, int data) {
+    // Find the end of the list
+    node *curr = list;
+    while (curr->next != NULL) {
+        curr = curr->next;
+    }
+
+    // Add a new element to the end of the list
+    curr->next = (node *)a->alloc(a->ctx, sizeof(node));
+
+    // Check if the allocation was successful
+    if (curr->next == NULL) {
+        return NULL;
+    }
+
+    // Initialize the new element
+    curr->next->data = data;
+    curr->next->next = NULL;
+
+    return curr->next;
+}
+
+/**
+ * Remove an element from the list
+ *
+ * @param a The allocator the nodes came from
+ * @param list The list to remove from
+ * @param index The index of the element to remove
+ * @return 0 if the element was removed, -1 if the element was not found
+ */
+int list_remove(const list_allocator *a, node **list, int index) {
+    // Check if the list is empty
+    if(*list == NULL) {
+        return -1;
+    }
+
+    // Remove the first element if the index is 0
+    node *curr = *list;
+    if (index == 0) {
+        *list = curr->next;
+        a->release(a->ctx, curr);
+        return 0;
+    }
+
+    // Find the element to remove
+    int i = 0;
+    while (curr != NULL && i < index - 1) {
+        curr = curr->next;
+        i++;
+    }
+
+    // Check if the element was found
+    if (curr == NULL || curr->next == NULL) {
+        return -1;
+    }
+
+    // Remove the element
+    node *next = curr->next->next;
+    a->release(a->ctx, curr->next);
+    curr->next = next;
+
+    return 0;
+}
+
+/**
+ * Remove all elements from the list
+ *
+ * @param a The allocator the nodes came from
+ * @param list The list to remove elements from
+ */
+void list_remove_all(const list_allocator *a, node *list) {
+    node *curr = list;
+    while (curr) {
+        node *next = curr->next;
+        a->release(a->ctx, curr);
+        curr = next;
+    }
+}
+
+/**
+ * Print all elements in the list
+ *
+ * @param list The list to print
+ */
+void list_print_all(node *list) {
+    node *curr = list;
+    while (curr) {
+        printf("%d\n", curr->data);
+        curr = curr->next;
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef CYB3053_PROJECT2_LIST_H
+#define CYB3053_PROJECT2_LIST_H
+
+#include <stddef.h>
+
+/**
+ * A simple linked list implementation to test the allocator
+ */
+typedef struct node {
+    int data; /**< The data stored in the list */
+    struct node *next; /**< The next element in the list */
+} node;
+
+/**
+ * Where the list gets its nodes from
+ */
+typedef struct list_allocator {
+    void *(*alloc)(void *ctx, size_t size); /**< Allocate a node, NULL on failure */
+    void (*release)(void *ctx, void *ptr); /**< Give a node back */
+    void *ctx; /**< Passed to both */
+} list_allocator;
+
+extern const list_allocator list_heap;
+
+node *list_new(const list_allocator *a, int data);
+node *list_add(const list_allocator *a, node *list, int data);
+int list_remove(const list_allocator *a, node **list, int index);
+void list_remove_all(const list_allocator *a, node *list);
+void list_print_all(node *list);
+
+#endif //CYB3053_PROJECT2_LIST_H
@@ -0,0 +1,144 @@
+#include "alloc.h"
+#include "pressure.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PRESSURE_POLL_MS 100 /**< Minimum time between two reads of the cgroup and PSI files */
+#define PRESSURE_PATH_LEN 256 /**< Maximum length of a configured path */
+
+#define USAGE_LEVEL1 80 /**< Percent of memory.max at which pressure level 1 starts */
+#define USAGE_LEVEL2 90 /**< Percent of memory.max at which pressure level 2 starts */
+#define USAGE_LEVEL3 95 /**< Percent of memory.max at which pressure level 3 starts */
+
+#define PSI_LEVEL1 1.0 /**< PSI "some avg10" percentage at which pressure level 1 starts */
+#define PSI_LEVEL2 10.0 /**< PSI "some avg10" percentage at which pressure level 2 starts */
+#define PSI_LEVEL3 40.0 /**< PSI "some avg10" percentage at which pressure level 3 starts */
+
+pthread_mutex_t pressure_lock = PTHREAD_MUTEX_INITIALIZER; /**< Serializes pressure reads and purges, and guards the paths below */
+
+static char cgroup_dir[PRESSURE_PATH_LEN] = "/sys/fs/cgroup"; /**< Directory holding memory.max and memory.current */
+static char psi_path[PRESSURE_PATH_LEN] = "/proc/pressure/memory"; /**< PSI file for memory */
+
+static uint64_t last_poll = 0; /**< Monotonic time in ns of the last read */
+static int polled = 0; /**< Whether the files have been read at least once */
+static int level = 0; /**< Pressure level computed by the last read */
+
+/**
+ * Point the allocator at a different cgroup directory and PSI file
+ *
+ * Mostly useful to drive the allocator with a fake cgroup directory. The
+ * next allocator slow path rereads both files. Waits for a poll in
+ * progress to finish.
+ *
+ * @param dir Directory containing memory.max and memory.current, or NULL to keep the current one
+ * @param psi Path of the memory PSI file, or NULL to keep the current one
+ */
+void tumalloc_set_cgroup_paths(const char *dir, const char *psi) {
+    pthread_mutex_lock(&pressure_lock);
+    if (dir) {
+        snprintf(cgroup_dir, sizeof(cgroup_dir), "%s", dir);
+    }
+    if (psi) {
+        snprintf(psi_path, sizeof(psi_path), "%s", psi);
+    }
+    polled = 0;
+    pthread_mutex_unlock(&pressure_lock);
+}
+
+/**
+ * Read a small text file into a buffer without going through stdio
+ *
+ * @param path The file to read
+ * @param buf The buffer to fill, NUL terminated on success
+ * @param len The size of the buffer
+ * @return 0 on success, -1 if the file cannot be read
+ */
+static int read_file(const char *path, char *buf, size_t len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, len - 1);
+    close(fd);
+    if (n < 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    return 0;
+}
+
+/**
+ * Read a byte count from a cgroup file
+ *
+ * @param name The file name inside the cgroup directory
+ * @param out Set to the value, or SIZE_MAX if the file says "max"
+ * @return 0 on success, -1 if the file cannot be read
+ */
+static int read_cgroup_value(const char *name, size_t *out) {
+    char path[PRESSURE_PATH_LEN + 32];
+    char buf[64];
+    snprintf(path, sizeof(path), "%s/%s", cgroup_dir, name);
+    if (read_file(path, buf, sizeof(buf)) != 0) {
+        return -1;
+    }
+    *out = strncmp(buf, "max", 3) == 0 ? SIZE_MAX : (size_t)strtoull(buf, NULL, 10);
+    return 0;
+}
+
+/**
+ * Read the share of time some task stalled on memory over the last 10 seconds
+ *
+ * @return The "some avg10" percentage, or 0 if PSI is unavailable
+ */
+static double read_psi_avg10(void) {
+    char buf[256];
+    if (read_file(psi_path, buf, sizeof(buf)) != 0) {
+        return 0;
+    }
+    char *avg = strstr(buf, "some avg10=");
+    return avg ? strtod(avg + strlen("some avg10="), NULL) : 0;
+}
+
+/**
+ * Compute the pressure level from cgroup usage and PSI
+ *
+ * @return The pressure level, from 0 to PRESSURE_LEVELS - 1
+ */
+static int compute_level(void) {
+    int result = 0;
+
+    size_t limit, usage;
+    if (read_cgroup_value("memory.max", &limit) == 0 && limit != SIZE_MAX && limit > 0 &&
+        read_cgroup_value("memory.current", &usage) == 0) {
+        size_t percent = usage / (limit / 100 ? limit / 100 : 1);
+        if (percent >= USAGE_LEVEL3) result = 3;
+        else if (percent >= USAGE_LEVEL2) result = 2;
+        else if (percent >= USAGE_LEVEL1) result = 1;
+    }
+
+    double psi = read_psi_avg10();
+    int psi_level = psi >= PSI_LEVEL3 ? 3 : psi >= PSI_LEVEL2 ? 2 : psi >= PSI_LEVEL1 ? 1 : 0;
+    return psi_level > result ? psi_level : result;
+}
+
+/**
+ * Get the current memory pressure level, rereading the files when due
+ *
+ * Must be called with pressure_lock held.
+ *
+ * @param now The current monotonic time in ns
+ * @param force Reread the files even if the last read is recent
+ * @return The pressure level, from 0 to PRESSURE_LEVELS - 1
+ */
+int pressure_poll(uint64_t now, int force) {
+    if (!force && polled && now - last_poll < (uint64_t)PRESSURE_POLL_MS * 1000000u) {
+        return level;
+    }
+    last_poll = now;
+    polled = 1;
+    level = compute_level();
+    return level;
+}
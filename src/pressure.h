@@ -0,0 +1,13 @@
+#ifndef CYB3053_PROJECT2_PRESSURE_H
+#define CYB3053_PROJECT2_PRESSURE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define PRESSURE_LEVELS 4 /**< Pressure levels run from 0 (none) to PRESSURE_LEVELS - 1 (critical) */
+
+extern pthread_mutex_t pressure_lock;
+
+int pressure_poll(uint64_t now, int force);
+
+#endif //CYB3053_PROJECT2_PRESSURE_H
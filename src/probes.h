@@ -0,0 +1,76 @@
+#ifndef CYB3053_PROJECT2_PROBES_H
+#define CYB3053_PROJECT2_PROBES_H
+
+#include <stdint.h>
+
+/*
+ * USDT probes under the provider "tumalloc", for perf and bpftrace, e.g.
+ *
+ *   bpftrace -e 'usdt:./prog:tumalloc:malloc_entry { @size = hist(arg0); }'
+ *   perf buildid-cache --add ./prog && perf list sdt_tumalloc:*
+ *
+ * Each probe is a single nop plus a note in .note.stapsdt that tells the
+ * tracer where the nop is and where to find the arguments, so an
+ * unattached probe costs the nop. The notes come from sys/sdt.h when it is
+ * installed, and otherwise are written out here in the same format.
+ * Arguments are passed as 64-bit unsigned values.
+ */
+
+#if defined(TUMALLOC_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PROBE1(name, a1) STAP_PROBE1(tumalloc, name, (uintptr_t)(a1)) /**< Probe with one argument */
+#define PROBE2(name, a1, a2) STAP_PROBE2(tumalloc, name, (uintptr_t)(a1), (uintptr_t)(a2)) /**< Probe with two arguments */
+#define PROBE3(name, a1, a2, a3) \
+    STAP_PROBE3(tumalloc, name, (uintptr_t)(a1), (uintptr_t)(a2), (uintptr_t)(a3)) /**< Probe with three arguments */
+#elif defined(__ELF__) && defined(__LP64__) && (defined(__x86_64__) || defined(__aarch64__))
+#define PROBE_ASM 1 /**< The notes are written by PROBE_NOTE */
+#endif
+#endif
+
+#ifdef PROBE_ASM
+/**
+ * The nop and its stapsdt note: the nop's address, the base used to detect
+ * prelinking, no semaphore, then provider, name and argument formats
+ */
+#define PROBE_NOTE(name, args)                                      \
+    "990: nop\n"                                                    \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n"                   \
+    ".balign 4\n"                                                   \
+    ".4byte 992f-991f, 994f-993f, 3\n"                              \
+    "991: .asciz \"stapsdt\"\n"                                     \
+    "992: .balign 4\n"                                              \
+    "993: .8byte 990b\n"                                            \
+    ".8byte _.stapsdt.base\n"                                       \
+    ".8byte 0\n"                                                    \
+    ".asciz \"tumalloc\"\n"                                         \
+    ".asciz \"" #name "\"\n"                                        \
+    ".asciz \"" args "\"\n"                                         \
+    "994: .balign 4\n"                                              \
+    ".popsection\n"                                                 \
+    ".ifndef _.stapsdt.base\n"                                      \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+    ".weak _.stapsdt.base\n"                                        \
+    ".hidden _.stapsdt.base\n"                                      \
+    "_.stapsdt.base: .space 1\n"                                    \
+    ".size _.stapsdt.base, 1\n"                                     \
+    ".popsection\n"                                                 \
+    ".endif\n"
+
+#define PROBE1(name, a1) \
+    __asm__ __volatile__(PROBE_NOTE(name, "8@%0") ::"nor"((uintptr_t)(a1))) /**< Probe with one argument */
+#define PROBE2(name, a1, a2)                                                  \
+    __asm__ __volatile__(PROBE_NOTE(name, "8@%0 8@%1") ::"nor"((uintptr_t)(a1)), \
+                         "nor"((uintptr_t)(a2))) /**< Probe with two arguments */
+#define PROBE3(name, a1, a2, a3)                                                        \
+    __asm__ __volatile__(PROBE_NOTE(name, "8@%0 8@%1 8@%2") ::"nor"((uintptr_t)(a1)),    \
+                         "nor"((uintptr_t)(a2)), "nor"((uintptr_t)(a3))) /**< Probe with three arguments */
+#endif
+
+#ifndef PROBE1
+#define PROBE1(name, a1) ((void)0) /**< Probes are compiled out */
+#define PROBE2(name, a1, a2) ((void)0) /**< Probes are compiled out */
+#define PROBE3(name, a1, a2, a3) ((void)0) /**< Probes are compiled out */
+#endif
+
+#endif //CYB3053_PROJECT2_PROBES_H
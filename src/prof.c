@@ -0,0 +1,402 @@
+#include "alloc.h"
+#include "prof.h"
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define PROF_DEPTH 32 /**< Most frames kept per stack trace */
+#define PROF_STACKS 4096 /**< Slots in the stack table, a power of two */
+#define PROF_OBJECTS 65536 /**< Slots in the table of tracked blocks, a power of two */
+
+/**
+ * A distinct allocation stack trace and what was sampled from it
+ */
+typedef struct prof_stack {
+    uint64_t hash; /**< Hash of the frames, 0 for an unused slot */
+    unsigned depth; /**< Number of frames */
+    void *frames[PROF_DEPTH]; /**< Return addresses, innermost first */
+    size_t live_count; /**< Sampled blocks from here not freed yet */
+    size_t live_bytes; /**< Their requested bytes */
+    size_t alloc_count; /**< Sampled blocks from here ever */
+    size_t alloc_bytes; /**< Their requested bytes */
+} prof_stack;
+
+/**
+ * A sampled block that has not been freed yet
+ */
+typedef struct prof_object {
+    header *block; /**< The block's header, NULL for an unused slot */
+    unsigned stack; /**< Index of its stack trace in prof_stacks */
+    size_t size; /**< The requested size */
+} prof_object;
+
+_Atomic size_t opt_prof = 0; /**< Whether allocations are sampled */
+_Atomic size_t opt_prof_sample = PROF_SAMPLE; /**< Mean bytes allocated between two samples */
+_Atomic size_t prof_tracked = 0; /**< Sampled blocks not freed yet, so frees can skip the lookup when there are none */
+
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER; /**< Protects the tables and counters below */
+static prof_stack *prof_stacks = NULL; /**< Stack table, mapped on the first sample */
+static prof_object *prof_objects = NULL; /**< Tracked blocks by header address, mapped on the first sample */
+static size_t prof_nstacks = 0; /**< Used slots in prof_stacks */
+static size_t prof_dropped = 0; /**< Samples not recorded because a table was full */
+static _Thread_local int64_t prof_left = 0; /**< Bytes the thread may still allocate before its next sample */
+static _Thread_local uint64_t prof_rng = 0; /**< The thread's random state, 0 until it first samples */
+
+/**
+ * Draw the number of bytes until the next sample
+ *
+ * The gaps are exponentially distributed with mean opt.prof_sample, so
+ * every allocated byte is equally likely to be sampled and the profile can
+ * be scaled back to the real heap. The logarithm is approximated to stay
+ * clear of libm.
+ *
+ * @return The bytes to allocate before the next sample, at least 1
+ */
+static int64_t prof_interval(void) {
+    // xorshift64*
+    prof_rng ^= prof_rng >> 12;
+    prof_rng ^= prof_rng << 25;
+    prof_rng ^= prof_rng >> 27;
+    uint64_t r = (prof_rng * 0x2545f4914f6cdd1dull) | 1;
+
+    // -ln(r / 2^64) from the position of the top bit and a quadratic fit of the rest
+    int msb = 63 - __builtin_clzll(r);
+    double m = (double)(r << (63 - msb)) / 9223372036854775808.0 - 1.0;
+    double log2 = msb + m * (1.3465 - 0.3465 * m);
+    double gap = (64.0 - log2) * 0.6931471805599453 * (double)opt_prof_sample;
+    return gap < 1.0 ? 1 : (int64_t)gap;
+}
+
+/**
+ * Map the tables on first use
+ *
+ * @return 0 on success, -1 if the memory cannot be mapped
+ */
+static int prof_tables(void) {
+    if (prof_stacks) {
+        return 0;
+    }
+    // Mapped directly so the profiler never allocates from the heap it watches
+    void *stacks = mmap(NULL, PROF_STACKS * sizeof(prof_stack), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void *objects = mmap(NULL, PROF_OBJECTS * sizeof(prof_object), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stacks == MAP_FAILED || objects == MAP_FAILED) {
+        if (stacks != MAP_FAILED) munmap(stacks, PROF_STACKS * sizeof(prof_stack));
+        if (objects != MAP_FAILED) munmap(objects, PROF_OBJECTS * sizeof(prof_object));
+        return -1;
+    }
+    prof_stacks = stacks;
+    prof_objects = objects;
+    return 0;
+}
+
+/**
+ * Find or add the slot of a stack trace
+ *
+ * @param frames The return addresses
+ * @param depth The number of frames
+ * @return The index in prof_stacks, or -1 if the table is full
+ */
+static int prof_stack_slot(void **frames, unsigned depth) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned i = 0; i < depth; i++) {
+        hash = (hash ^ (uintptr_t)frames[i]) * 1099511628211ull;
+    }
+    hash |= 1;
+
+    for (size_t i = hash & (PROF_STACKS - 1);; i = (i + 1) & (PROF_STACKS - 1)) {
+        prof_stack *st = &prof_stacks[i];
+        if (st->hash == hash && st->depth == depth && memcmp(st->frames, frames, depth * sizeof(void *)) == 0) {
+            return (int)i;
+        }
+        if (st->hash == 0) {
+            // Keep a quarter free so probes stay short
+            if (prof_nstacks >= PROF_STACKS / 4 * 3) {
+                return -1;
+            }
+            st->hash = hash;
+            st->depth = depth;
+            memcpy(st->frames, frames, depth * sizeof(void *));
+            prof_nstacks++;
+            return (int)i;
+        }
+    }
+}
+
+/**
+ * Get the home slot of a block in prof_objects
+ *
+ * @param block The header of the block
+ * @return The slot where probing for the block starts
+ */
+static size_t prof_home(header *block) {
+    return (size_t)(((uintptr_t)block >> 4) * 0x9e3779b97f4a7c15ull >> 48) & (PROF_OBJECTS - 1);
+}
+
+/**
+ * Find the slot of a tracked block
+ *
+ * @param block The header of the block
+ * @return The index in prof_objects, or -1 if the block is not tracked
+ */
+static long prof_find(header *block) {
+    if (prof_objects == NULL) {
+        return -1;
+    }
+    for (size_t i = prof_home(block);; i = (i + 1) & (PROF_OBJECTS - 1)) {
+        if (prof_objects[i].block == block) {
+            return (long)i;
+        }
+        if (prof_objects[i].block == NULL) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * Start tracking a block
+ *
+ * @param block The header of the block
+ * @param stack Index of its stack trace
+ * @param size The requested size
+ * @return 0 on success, -1 if the table is full
+ */
+static int prof_insert(header *block, unsigned stack, size_t size) {
+    if (prof_tracked >= PROF_OBJECTS / 4 * 3) {
+        return -1;
+    }
+    size_t i = prof_home(block);
+    while (prof_objects[i].block) {
+        i = (i + 1) & (PROF_OBJECTS - 1);
+    }
+    prof_objects[i] = (prof_object){block, stack, size};
+    prof_tracked++;
+    return 0;
+}
+
+/**
+ * Stop tracking a block, closing the gap so later probes still find theirs
+ *
+ * @param i The index of the block in prof_objects
+ */
+static void prof_remove(size_t i) {
+    size_t hole = i;
+    for (size_t j = (i + 1) & (PROF_OBJECTS - 1); prof_objects[j].block; j = (j + 1) & (PROF_OBJECTS - 1)) {
+        // Move an entry back into the hole unless its home lies between the hole and it
+        size_t home = prof_home(prof_objects[j].block);
+        if (((j - home) & (PROF_OBJECTS - 1)) >= ((j - hole) & (PROF_OBJECTS - 1))) {
+            prof_objects[hole] = prof_objects[j];
+            hole = j;
+        }
+    }
+    prof_objects[hole].block = NULL;
+    prof_tracked--;
+}
+
+/**
+ * Count an allocation towards the next sample and take it if due
+ *
+ * Called for every block handed out while opt.prof is set. A sampled
+ * block gets HEADER_SAMPLED so tufree knows to look it up.
+ *
+ * @param block The header of the block, flags cleared
+ * @param size The requested size
+ */
+void prof_alloc(header *block, size_t size) {
+    if (prof_rng == 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        prof_rng = ((uintptr_t)&prof_rng ^ (uint64_t)ts.tv_nsec * 0x9e3779b97f4a7c15ull) | 1;
+        prof_left = prof_interval();
+    }
+    prof_left -= (int64_t)size;
+    if (prof_left >= 0) {
+        return;
+    }
+    prof_left = prof_interval();
+
+    // The first frame is this function
+    void *frames[PROF_DEPTH + 1];
+    int depth = backtrace(frames, PROF_DEPTH + 1);
+    if (depth < 2) {
+        return;
+    }
+
+    pthread_mutex_lock(&prof_lock);
+    int stack = prof_tables() == 0 ? prof_stack_slot(frames + 1, (unsigned)depth - 1) : -1;
+    if (stack < 0 || prof_insert(block, (unsigned)stack, size) != 0) {
+        prof_dropped++;
+    } else {
+        prof_stack *st = &prof_stacks[stack];
+        st->live_count++;
+        st->live_bytes += size;
+        st->alloc_count++;
+        st->alloc_bytes += size;
+        block->flags |= HEADER_SAMPLED;
+    }
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/**
+ * Stop tracking a sampled block being freed
+ *
+ * @param block The header of the block, still intact
+ */
+void prof_release(header *block) {
+    pthread_mutex_lock(&prof_lock);
+    long i = prof_find(block);
+    if (i >= 0) {
+        prof_stack *st = &prof_stacks[prof_objects[i].stack];
+        st->live_count--;
+        st->live_bytes -= prof_objects[i].size;
+        prof_remove((size_t)i);
+    }
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/**
+ * Follow a sampled block that moved, as mremap can do
+ *
+ * @param from The old header address
+ * @param to The new header address
+ */
+void prof_move(header *from, header *to) {
+    pthread_mutex_lock(&prof_lock);
+    long i = prof_find(from);
+    if (i >= 0) {
+        prof_object moved = prof_objects[i];
+        prof_remove((size_t)i);
+        prof_insert(to, moved.stack, moved.size);
+    }
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/**
+ * Write the heap profile in the text format pprof reads
+ *
+ * The format is the legacy gperftools heap profile: a header with the
+ * totals and the sampling rate, one line per stack trace with its live and
+ * total sampled blocks and bytes, then the process's mappings so pprof can
+ * symbolize the addresses. pprof scales the sampled numbers back up using
+ * the rate, e.g. `pprof -top ./program heap.prof`.
+ *
+ * @param path The file to write
+ * @return 0 on success, -1 if the file cannot be written
+ */
+int tumalloc_prof_dump(const char *path) {
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&prof_lock);
+    size_t live_count = 0, live_bytes = 0, alloc_count = 0, alloc_bytes = 0;
+    for (size_t i = 0; prof_stacks && i < PROF_STACKS; i++) {
+        live_count += prof_stacks[i].live_count;
+        live_bytes += prof_stacks[i].live_bytes;
+        alloc_count += prof_stacks[i].alloc_count;
+        alloc_bytes += prof_stacks[i].alloc_bytes;
+    }
+    fprintf(out, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n", live_count, live_bytes, alloc_count,
+            alloc_bytes, (size_t)opt_prof_sample);
+    for (size_t i = 0; prof_stacks && i < PROF_STACKS; i++) {
+        prof_stack *st = &prof_stacks[i];
+        if (st->hash == 0) continue;
+        fprintf(out, "%zu: %zu [%zu: %zu] @", st->live_count, st->live_bytes, st->alloc_count, st->alloc_bytes);
+        for (unsigned f = 0; f < st->depth; f++) {
+            fprintf(out, " %p", st->frames[f]);
+        }
+        fprintf(out, "\n");
+    }
+    pthread_mutex_unlock(&prof_lock);
+
+    fprintf(out, "\nMAPPED_LIBRARIES:\n");
+    int maps = open("/proc/self/maps", O_RDONLY);
+    if (maps >= 0) {
+        char buf[4096];
+        ssize_t n;
+        while ((n = read(maps, buf, sizeof(buf))) > 0) {
+            fwrite(buf, 1, (size_t)n, out);
+        }
+        close(maps);
+    }
+    int failed = ferror(out);
+    return fclose(out) != 0 || failed ? -1 : 0;
+}
+
+/**
+ * Write a snapshot of the live heap for tusnapdiff
+ *
+ * A snapshot has the live bytes and blocks of every size class, exact,
+ * from the allocator's own counters, and the live sampled blocks and bytes
+ * of every allocation site the profiler has seen. Sites are only listed
+ * while opt.prof is or was set. Two snapshots of the same process, taken
+ * before and after a phase, can be compared with
+ * `tusnapdiff before.snap after.snap`.
+ *
+ * Lines are "tumalloc snapshot 1" first, then "rate <bytes>",
+ * "allocated <bytes>", "active <bytes>", then
+ * "class <size> <blocks> <bytes>" with the smallest size of the class, and
+ * "site <blocks> <bytes> @ <addresses>" with sampled numbers.
+ *
+ * @param path The file to write
+ * @return 0 on success, -1 if the file cannot be written
+ */
+int tumalloc_snapshot(const char *path) {
+    tustats stats;
+    tumalloc_stats(&stats);
+
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        return -1;
+    }
+    fprintf(out, "tumalloc snapshot 1\nrate %zu\nallocated %zu\nactive %zu\n", (size_t)opt_prof_sample,
+            stats.allocated, stats.active);
+    for (size_t i = 0; i < TUSTATS_SMALL_CLASSES; i++) {
+        size_t size = 16 * (i + 1);
+        if (stats.small_live[i]) {
+            fprintf(out, "class %zu %zu %zu\n", size, stats.small_live[i], stats.small_live[i] * size);
+        }
+    }
+    for (size_t i = 0; i < TUSTATS_LARGE_BUCKETS; i++) {
+        if (stats.large_live[i]) {
+            fprintf(out, "class %zu %zu %zu\n", (size_t)(4 + i % 4) << (i / 4 + 7), stats.large_live[i],
+                    stats.large_live_bytes[i]);
+        }
+    }
+
+    pthread_mutex_lock(&prof_lock);
+    for (size_t i = 0; prof_stacks && i < PROF_STACKS; i++) {
+        prof_stack *st = &prof_stacks[i];
+        if (st->hash == 0 || st->live_count == 0) continue;
+        fprintf(out, "site %zu %zu @", st->live_count, st->live_bytes);
+        for (unsigned f = 0; f < st->depth; f++) {
+            fprintf(out, " %p", st->frames[f]);
+        }
+        fprintf(out, "\n");
+    }
+    pthread_mutex_unlock(&prof_lock);
+
+    int failed = ferror(out);
+    return fclose(out) != 0 || failed ? -1 : 0;
+}
+
+/**
+ * Get the number of samples the profiler had to drop
+ *
+ * @return Samples lost because the stack or block table was full
+ */
+size_t tumalloc_prof_dropped(void) {
+    pthread_mutex_lock(&prof_lock);
+    size_t dropped = prof_dropped;
+    pthread_mutex_unlock(&prof_lock);
+    return dropped;
+}
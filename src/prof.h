@@ -0,0 +1,18 @@
+#ifndef CYB3053_PROJECT2_PROF_H
+#define CYB3053_PROJECT2_PROF_H
+
+#include "alloc.h"
+#include <stddef.h>
+
+#define PROF_SAMPLE (512 * 1024) /**< Default for opt.prof_sample: mean bytes allocated between two samples */
+#define HEADER_SAMPLED 0x1 /**< Header flag of blocks the heap profiler is tracking */
+
+extern _Atomic size_t opt_prof;
+extern _Atomic size_t opt_prof_sample;
+extern _Atomic size_t prof_tracked;
+
+void prof_alloc(header *block, size_t size);
+void prof_release(header *block);
+void prof_move(header *from, header *to);
+
+#endif //CYB3053_PROJECT2_PROF_H
@@ -0,0 +1,148 @@
+#include "alloc.h"
+#include "region.h"
+#include <stdint.h>
+
+#define REGION_ALIGN 16 /**< Alignment of every object handed out by a region */
+#define REGION_CHUNK (64 * 1024) /**< Default chunk size, small enough to come from the main heap */
+
+/**
+ * A chunk of main heap memory objects are bumped out of
+ */
+typedef struct region_chunk {
+    struct region_chunk *next; /**< The next chunk of the region */
+    size_t size; /**< Usable bytes after this header */
+} region_chunk;
+
+_Static_assert(sizeof(region_chunk) % REGION_ALIGN == 0, "chunk payloads must stay aligned");
+
+/**
+ * A region hands out objects without headers and frees them all at once
+ *
+ * Chunks stay linked in the order they were taken. A reset only moves the
+ * bump pointer back to the first chunk, and later chunks are reused as the
+ * region fills up again.
+ */
+struct turegion {
+    region_chunk *first; /**< The first chunk, NULL until the first allocation */
+    region_chunk *current; /**< The chunk objects are currently bumped from */
+    char *next; /**< Start of the free space in the current chunk */
+    char *end; /**< End of the current chunk */
+    size_t chunk_size; /**< Usable size of a regular chunk */
+};
+
+/**
+ * Create an empty region
+ *
+ * @param chunk_size Usable bytes per chunk, 0 for the default of 64 KiB
+ * @return The region, or NULL if out of memory
+ */
+turegion *turegion_create(size_t chunk_size) {
+    turegion *region = tumallocx(sizeof(turegion), TUMALLOCX_ARENA(0));
+    if (region == NULL) {
+        return NULL;
+    }
+    region->first = NULL;
+    region->current = NULL;
+    region->next = NULL;
+    region->end = NULL;
+    region->chunk_size = chunk_size ? (chunk_size + REGION_ALIGN - 1) & ~(size_t)(REGION_ALIGN - 1) : REGION_CHUNK;
+    return region;
+}
+
+/**
+ * Make a chunk with room for a request current, reusing chunks kept by a reset
+ *
+ * @param region The region
+ * @param size The aligned request size
+ * @return 0 on success, -1 if out of memory
+ */
+static int region_advance(turegion *region, size_t size) {
+    region_chunk *chunk = region->current ? region->current->next : region->first;
+
+    // Chunks too small for this request are skipped until the next reset
+    while (chunk && chunk->size < size) {
+        chunk = chunk->next;
+    }
+
+    if (chunk == NULL) {
+        size_t len = size > region->chunk_size ? size : region->chunk_size;
+        if (len > SIZE_MAX - sizeof(region_chunk)) {
+            return -1;
+        }
+        chunk = tumallocx(sizeof(region_chunk) + len, TUMALLOCX_ARENA(0));
+        if (chunk == NULL) {
+            return -1;
+        }
+        chunk->size = len;
+
+        // New chunks go right after the current one so a reset finds them in order
+        if (region->current) {
+            chunk->next = region->current->next;
+            region->current->next = chunk;
+        } else {
+            chunk->next = region->first;
+            region->first = chunk;
+        }
+    }
+
+    region->current = chunk;
+    region->next = (char *)(chunk + 1);
+    region->end = region->next + chunk->size;
+    return 0;
+}
+
+/**
+ * Allocate an object from a region
+ *
+ * The object has no header and cannot be freed on its own, it lives until
+ * the region is reset or destroyed.
+ *
+ * @param region The region
+ * @param size The size of the object
+ * @return A pointer aligned to 16 bytes, or NULL if out of memory
+ */
+void *turegion_alloc(turegion *region, size_t size) {
+    size_t aligned = (size + REGION_ALIGN - 1) & ~(size_t)(REGION_ALIGN - 1);
+    if (aligned < size) {
+        return NULL;
+    }
+    if ((size_t)(region->end - region->next) < aligned) {
+        if (region_advance(region, aligned) != 0) {
+            return NULL;
+        }
+    }
+    void *ptr = region->next;
+    region->next += aligned;
+    return ptr;
+}
+
+/**
+ * Release every object of a region at once
+ *
+ * This takes constant time. The chunks are kept for the objects allocated
+ * after the reset.
+ *
+ * @param region The region
+ */
+void turegion_reset(turegion *region) {
+    region->current = NULL;
+    region->next = NULL;
+    region->end = NULL;
+}
+
+/**
+ * Destroy a region, returning its chunks to the main heap
+ *
+ * @param region The region, or NULL
+ */
+void turegion_destroy(turegion *region) {
+    if (!region) return;
+
+    region_chunk *chunk = region->first;
+    while (chunk) {
+        region_chunk *next = chunk->next;
+        tufree(chunk);
+        chunk = next;
+    }
+    tufree(region);
+}
@@ -0,0 +1,13 @@
+#ifndef CYB3053_PROJECT2_REGION_H
+#define CYB3053_PROJECT2_REGION_H
+
+#include <stddef.h>
+
+typedef struct turegion turegion;
+
+turegion *turegion_create(size_t chunk_size);
+void *turegion_alloc(turegion *region, size_t size);
+void turegion_reset(turegion *region);
+void turegion_destroy(turegion *region);
+
+#endif //CYB3053_PROJECT2_REGION_H
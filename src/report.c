@@ -0,0 +1,350 @@
+#define _GNU_SOURCE /**< For pipe2 */
+
+#include "alloc.h"
+#include "ctl.h"
+#include "report.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * A report being written, buffered on the stack
+ */
+typedef struct report_out {
+    int fd; /**< The report file */
+    int failed; /**< Whether a write failed */
+    size_t len; /**< Bytes in buf */
+    char buf[4096]; /**< Text not written yet */
+} report_out;
+
+/**
+ * A size class or bucket with its live blocks
+ */
+typedef struct report_class {
+    size_t size; /**< Smallest block size of the class */
+    size_t blocks; /**< Live blocks */
+    size_t bytes; /**< Their usable bytes */
+} report_class;
+
+_Atomic size_t opt_report_signal = REPORT_SIGNAL; /**< Signal TUMALLOC_CONF's report path is dumped on */
+
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER; /**< Protects the state below */
+static int report_pipe[2] = {-1, -1}; /**< The handler writes a byte to [1], the helper thread reads [0] */
+static int report_signo = 0; /**< The signal handled, 0 until set up */
+static size_t report_count = 0; /**< Reports written so far */
+static char report_path[REPORT_PATH_MAX]; /**< Where signalled reports go */
+
+/**
+ * Write out the buffered text
+ *
+ * @param out The report
+ */
+static void report_flush(report_out *out) {
+    const char *at = out->buf;
+    while (out->len > 0 && !out->failed) {
+        ssize_t n = write(out->fd, at, out->len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            out->failed = 1;
+            break;
+        }
+        at += n;
+        out->len -= (size_t)n;
+    }
+    out->len = 0;
+}
+
+/**
+ * Append formatted text to the report
+ *
+ * Formats into the stack buffer with vsnprintf, never through stdio
+ * streams, so nothing is allocated.
+ *
+ * @param out The report
+ * @param fmt The printf format
+ */
+__attribute__((format(printf, 2, 3))) static void report_printf(report_out *out, const char *fmt, ...) {
+    if (out->len > sizeof(out->buf) / 2) {
+        report_flush(out);
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(out->buf + out->len, sizeof(out->buf) - out->len, fmt, ap);
+    va_end(ap);
+    if (n > 0) {
+        size_t room = sizeof(out->buf) - out->len - 1;
+        out->len += (size_t)n < room ? (size_t)n : room;
+    }
+}
+
+/**
+ * Write the size classes holding the most live bytes
+ *
+ * @param out The report
+ * @param stats The statistics to take them from
+ */
+static void report_top(report_out *out, const tustats *stats) {
+    report_class top[REPORT_TOP];
+    size_t ntop = 0;
+    for (size_t i = 0; i < TUSTATS_SMALL_CLASSES + TUSTATS_LARGE_BUCKETS; i++) {
+        report_class c;
+        if (i < TUSTATS_SMALL_CLASSES) {
+            c.size = 16 * (i + 1);
+            c.blocks = stats->small_live[i];
+            c.bytes = c.blocks * c.size;
+        } else {
+            size_t b = i - TUSTATS_SMALL_CLASSES;
+            c.size = (size_t)(4 + b % 4) << (b / 4 + 7);
+            c.blocks = stats->large_live[b];
+            c.bytes = stats->large_live_bytes[b];
+        }
+        if (c.blocks == 0) continue;
+
+        // Insertion into the list kept sorted by bytes, largest first
+        size_t at = ntop < REPORT_TOP ? ntop++ : REPORT_TOP;
+        while (at > 0 && top[at - 1].bytes < c.bytes) {
+            if (at < REPORT_TOP) {
+                top[at] = top[at - 1];
+            }
+            at--;
+        }
+        if (at < REPORT_TOP) {
+            top[at] = c;
+        }
+    }
+
+    report_printf(out, "top size classes by live bytes:\n");
+    for (size_t i = 0; i < ntop; i++) {
+        report_printf(out, "  size %10zu  %10zu blocks  %14zu bytes\n", top[i].size, top[i].blocks, top[i].bytes);
+    }
+    if (ntop == 0) {
+        report_printf(out, "  none\n");
+    }
+}
+
+/**
+ * Write a report to an open file
+ *
+ * @param fd The file
+ * @param seq Number of the report, shown in its heading
+ * @return 0 on success, -1 if a write failed
+ */
+static int report_write(int fd, size_t seq) {
+    report_out out;
+    out.fd = fd;
+    out.failed = 0;
+    out.len = 0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    report_printf(&out, "=== tumalloc report %zu, pid %d, time %lld ===\n", seq, (int)getpid(), (long long)now.tv_sec);
+
+    tustats stats;
+    tumalloc_stats(&stats);
+    report_printf(&out, "allocated %zu  active %zu  mapped %zu  retained %zu\n", stats.allocated, stats.active,
+                  stats.mapped, stats.retained);
+    report_printf(&out, "nmalloc %zu  nfree %zu  nrealloc %zu  tcache hits %zu  misses %zu\n", stats.nmalloc,
+                  stats.nfree, stats.nrealloc, stats.tcache_hits, stats.tcache_misses);
+    report_printf(&out, "large cache %zu bytes in %zu mappings  hits %zu  misses %zu\n", stats.large_cache_bytes,
+                  stats.large_cache_mappings, stats.large_cache_hits, stats.large_cache_misses);
+    report_printf(&out, "pressure %d  purged %zu  locked %zu  unpinned %zu\n", stats.pressure_level,
+                  stats.purged_bytes, stats.locked_bytes, stats.unpinned_bytes);
+    report_printf(&out, "searches hit %zu  missed %zu  visited %zu  fit waste %zu\n", stats.search_hits,
+                  stats.search_misses, stats.search_visited, stats.fit_wasted_bytes);
+
+    unsigned count = arena_count();
+    for (unsigned i = 0; i < count; i++) {
+        tufrag frag;
+        if (tumalloc_frag(i, &frag) != 0) continue;
+        report_printf(&out, "arena %u: footprint %zu  free %zu in %zu blocks  largest %zu  external %.3f\n", i,
+                      frag.footprint, frag.free_bytes, frag.free_blocks, frag.largest_free, frag.external);
+        report_printf(&out, "  live %zu blocks  headers %zu  rounding %zu  metadata %zu  cached %zu\n",
+                      frag.live_blocks, frag.header_bytes, frag.rounding_bytes, frag.metadata_bytes,
+                      frag.cached_bytes);
+    }
+    report_top(&out, &stats);
+    report_printf(&out, "\n");
+    report_flush(&out);
+    return out.failed ? -1 : 0;
+}
+
+/**
+ * Write an allocator report to a file
+ *
+ * The report has the statistics, the fragmentation of every arena and
+ * the size classes holding the most live bytes. It is appended, so
+ * successive reports to the same file can be compared. Nothing is
+ * allocated; the text is formatted on the stack and written with write(2).
+ *
+ * @param path The file to append to
+ * @return 0 on success, -1 with errno set if the file cannot be written
+ */
+int tumalloc_report(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&report_lock);
+    size_t seq = ++report_count;
+    pthread_mutex_unlock(&report_lock);
+
+    int rc = report_write(fd, seq);
+    int saved = errno;
+    if (close(fd) != 0 && rc == 0) {
+        return -1;
+    }
+    errno = saved;
+    return rc;
+}
+
+/**
+ * Signal handler: wake the helper thread
+ *
+ * Only write(2) is called, which is async-signal-safe. The pipe does not
+ * block, so signals arriving faster than reports are written fold into one.
+ *
+ * @param signo The signal
+ */
+static void report_signal(int signo) {
+    (void)signo;
+    int saved = errno;
+    char byte = 0;
+    ssize_t n = write(report_pipe[1], &byte, 1);
+    (void)n;
+    errno = saved;
+}
+
+/**
+ * Helper thread: write a report whenever the handler wakes it
+ *
+ * @param arg Unused
+ * @return Never returns
+ */
+static void *report_thread(void *arg) {
+    (void)arg;
+    for (;;) {
+        char drain[64];
+        ssize_t n = read(report_pipe[0], drain, sizeof(drain));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+
+        char path[REPORT_PATH_MAX];
+        pthread_mutex_lock(&report_lock);
+        memcpy(path, report_path, sizeof(path));
+        pthread_mutex_unlock(&report_lock);
+        if (tumalloc_report(path) != 0) {
+            char msg[] = "tumalloc: cannot write the signalled report\n";
+            ssize_t w = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+            (void)w;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Write a report to a file whenever the process gets a signal
+ *
+ * The signal handler only writes a byte to a pipe. A helper thread,
+ * started here with every signal blocked, reads the pipe and writes the
+ * report with tumalloc_report, so no allocator code runs in the handler.
+ * Calling this again changes the path; the signal can only be set once.
+ * TUMALLOC_CONF can set this up too, with report:<path> and, instead of
+ * SIGUSR2, report_signal:<number>. E.g. `kill -USR2 <pid>` then appends
+ * a report to the path.
+ *
+ * @param signo The signal, such as SIGUSR2
+ * @param path The file reports are appended to
+ * @return 0 on success, -1 with errno set: EINVAL for a bad signal or
+ *         path, EBUSY for another signal than the one set up before
+ */
+int tumalloc_report_on_signal(int signo, const char *path) {
+    if (signo <= 0 || signo >= NSIG || signo == SIGKILL || signo == SIGSTOP || path == NULL ||
+        strlen(path) >= REPORT_PATH_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&report_lock);
+    if (report_signo != 0 && report_signo != signo) {
+        pthread_mutex_unlock(&report_lock);
+        errno = EBUSY;
+        return -1;
+    }
+    strcpy(report_path, path);
+    if (report_signo != 0) {
+        pthread_mutex_unlock(&report_lock);
+        return 0;
+    }
+
+    if (pipe2(report_pipe, O_CLOEXEC) != 0) {
+        pthread_mutex_unlock(&report_lock);
+        return -1;
+    }
+    fcntl(report_pipe[1], F_SETFL, O_NONBLOCK);
+
+    // The helper never takes the signal itself, it blocks everything
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t thread;
+    int err = pthread_create(&thread, NULL, report_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = report_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (err != 0 || sigaction(signo, &sa, NULL) != 0) {
+        int saved = err ? err : errno;
+        close(report_pipe[1]);
+        if (err != 0) {
+            close(report_pipe[0]);
+        }
+        report_pipe[0] = report_pipe[1] = -1;
+        pthread_mutex_unlock(&report_lock);
+        errno = saved;
+        return -1;
+    }
+    pthread_detach(thread);
+    report_signo = signo;
+    pthread_mutex_unlock(&report_lock);
+    return 0;
+}
+
+/**
+ * Remember a report path from TUMALLOC_CONF
+ *
+ * @param path The path, not NUL-terminated
+ * @param len The length of the path
+ * @return 0 on success, -1 if the path is empty or too long
+ */
+int report_conf(const char *path, size_t len) {
+    if (len == 0 || len >= REPORT_PATH_MAX) {
+        return -1;
+    }
+    pthread_mutex_lock(&report_lock);
+    memcpy(report_path, path, len);
+    report_path[len] = '\0';
+    pthread_mutex_unlock(&report_lock);
+    return 0;
+}
+
+/**
+ * Set up the signal TUMALLOC_CONF asked for, once the whole string is read
+ */
+void report_conf_start(void) {
+    char path[REPORT_PATH_MAX];
+    pthread_mutex_lock(&report_lock);
+    memcpy(path, report_path, sizeof(path));
+    pthread_mutex_unlock(&report_lock);
+    if (path[0] && tumalloc_report_on_signal((int)opt_report_signal, path) != 0) {
+        fprintf(stderr, "tumalloc: cannot report on signal %zu to %s\n", (size_t)opt_report_signal, path);
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef CYB3053_PROJECT2_REPORT_H
+#define CYB3053_PROJECT2_REPORT_H
+
+#include <signal.h>
+#include <stddef.h>
+
+#define REPORT_SIGNAL SIGUSR2 /**< Default for opt.report_signal */
+#define REPORT_PATH_MAX 256 /**< Longest report path TUMALLOC_CONF or tumalloc_report_on_signal may give */
+#define REPORT_TOP 10 /**< Size classes listed in a report */
+
+extern _Atomic size_t opt_report_signal;
+
+int report_conf(const char *path, size_t len);
+void report_conf_start(void);
+
+#endif //CYB3053_PROJECT2_REPORT_H
@@ -0,0 +1,215 @@
+#include "alloc.h"
+#include "scratch.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCRATCH_ALIGN 16 /**< Alignment of every scratch allocation */
+#define SCRATCH_CHUNK (32 * 1024) /**< Size of the first chunk, later chunks double up to SCRATCH_CHUNK_MAX */
+#define SCRATCH_CHUNK_MAX (1024 * 1024) /**< Largest chunk taken for regular allocations */
+#define SCRATCH_LIMIT (64 * 1024 * 1024) /**< Default cap on the scratch memory of a thread */
+#define SCRATCH_POISON 0xdb /**< Byte released scratch memory is filled with in debug builds */
+
+/**
+ * A chunk of the scratch stack
+ */
+typedef struct scratch_chunk {
+    struct scratch_chunk *prev; /**< The chunk below this one */
+    size_t size; /**< Usable bytes after this header */
+} scratch_chunk;
+
+_Static_assert(sizeof(scratch_chunk) % SCRATCH_ALIGN == 0, "chunk payloads must stay aligned");
+
+/**
+ * The scratch stack of a thread
+ */
+typedef struct scratch {
+    scratch_chunk *current; /**< The top chunk, NULL while the stack is empty */
+    scratch_chunk *spare; /**< The last chunk popped, kept so a loop around a chunk edge does not thrash */
+    char *top; /**< Start of the free space in the current chunk */
+    char *end; /**< End of the current chunk */
+    size_t bytes; /**< Usable bytes of all chunks on the stack */
+    size_t limit; /**< Allocations that would take bytes past this fail */
+    int registered; /**< Whether the thread exit cleanup is set up */
+} scratch;
+
+static _Thread_local scratch thread_scratch = {.limit = SCRATCH_LIMIT}; /**< The calling thread's stack */
+static pthread_key_t scratch_key; /**< Runs scratch_exit when a thread with scratch chunks exits */
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT; /**< Creates scratch_key */
+
+/**
+ * Pop the top chunk, keeping it as the spare
+ *
+ * @param s The thread's stack
+ */
+static void scratch_pop(scratch *s) {
+    scratch_chunk *chunk = s->current;
+    s->current = chunk->prev;
+    s->bytes -= chunk->size;
+    if (s->spare) {
+        tufree(s->spare);
+    }
+    s->spare = chunk;
+
+    if (s->current) {
+        s->end = (char *)(s->current + 1) + s->current->size;
+    } else {
+        s->top = NULL;
+        s->end = NULL;
+    }
+}
+
+/**
+ * Free the scratch chunks of an exiting thread
+ *
+ * @param arg The thread's stack
+ */
+static void scratch_exit(void *arg) {
+    scratch *s = arg;
+    while (s->current) {
+        scratch_pop(s);
+    }
+    tufree(s->spare);
+    s->spare = NULL;
+}
+
+/**
+ * Create the key whose destructor frees scratch chunks at thread exit
+ */
+static void scratch_init(void) {
+    pthread_key_create(&scratch_key, scratch_exit);
+}
+
+/**
+ * Push a chunk with room for a request
+ *
+ * @param s The thread's stack
+ * @param size The aligned request size
+ * @return 0 on success, -1 if over the limit or out of memory
+ */
+static int scratch_push(scratch *s, size_t size) {
+    if (size > s->limit || s->bytes > s->limit - size) {
+        return -1;
+    }
+
+    scratch_chunk *chunk = s->spare;
+    if (chunk && chunk->size >= size) {
+        s->spare = NULL;
+    } else {
+        size_t len = s->current ? s->current->size * 2 : SCRATCH_CHUNK;
+        if (len > SCRATCH_CHUNK_MAX) {
+            len = SCRATCH_CHUNK_MAX;
+        }
+        if (len < size) {
+            len = size;
+        }
+        if (len > s->limit - s->bytes) {
+            len = s->limit - s->bytes;
+        }
+        chunk = tumalloc(sizeof(scratch_chunk) + len);
+        if (chunk == NULL) {
+            return -1;
+        }
+        chunk->size = len;
+    }
+
+    if (!s->registered) {
+        pthread_once(&scratch_once, scratch_init);
+        pthread_setspecific(scratch_key, s);
+        s->registered = 1;
+    }
+
+    chunk->prev = s->current;
+    s->current = chunk;
+    s->bytes += chunk->size;
+    s->top = (char *)(chunk + 1);
+    s->end = s->top + chunk->size;
+    return 0;
+}
+
+/**
+ * Get a checkpoint of the calling thread's scratch stack
+ *
+ * @return The mark to pass to tuscratch_release
+ */
+void *tuscratch_mark(void) {
+    return thread_scratch.top;
+}
+
+/**
+ * Allocate from the calling thread's scratch stack
+ *
+ * The memory lives until a mark taken before this call is released. Only
+ * the thread that allocated it may release it, but any thread may use it
+ * until then.
+ *
+ * @param size The amount of memory to allocate
+ * @return A pointer aligned to 16 bytes, or NULL if out of memory or over the limit
+ */
+void *tuscratch_alloc(size_t size) {
+    scratch *s = &thread_scratch;
+    size_t aligned = (size + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1);
+    if (aligned < size) {
+        return NULL;
+    }
+    if ((size_t)(s->end - s->top) < aligned && scratch_push(s, aligned) != 0) {
+        return NULL;
+    }
+    void *ptr = s->top;
+    s->top += aligned;
+    return ptr;
+}
+
+/**
+ * Release everything allocated on the calling thread's scratch stack since a mark
+ *
+ * Marks must be released in the reverse order they were taken. Releasing
+ * a mark also releases every mark taken after it. Building with
+ * TUMALLOC_DEBUG aborts on a mark that is not on the stack any more and
+ * poisons released memory.
+ *
+ * @param mark A mark from tuscratch_mark
+ */
+void tuscratch_release(void *mark) {
+    scratch *s = &thread_scratch;
+    char *target = mark;
+
+    // Pop chunks until the mark is in the top one
+    while (s->current && !(target >= (char *)(s->current + 1) && target <= s->end)) {
+#ifdef TUMALLOC_DEBUG
+        memset(s->current + 1, SCRATCH_POISON, (size_t)(s->top - (char *)(s->current + 1)));
+#endif
+        scratch_pop(s);
+        if (s->current) {
+            s->top = s->end;
+        }
+    }
+
+#ifdef TUMALLOC_DEBUG
+    if (target != NULL && (s->current == NULL || target > s->top)) {
+        fprintf(stderr, "tuscratch_release: stale mark %p\n", mark);
+        abort();
+    }
+    if (target) {
+        memset(target, SCRATCH_POISON, (size_t)(s->top - target));
+    }
+#endif
+    if (s->current) {
+        s->top = target;
+    }
+}
+
+/**
+ * Cap the scratch memory of the calling thread
+ *
+ * This guards against runaway recursion the way a stack limit would,
+ * except that tuscratch_alloc returns NULL instead of crashing. Chunks
+ * already on the stack are not affected.
+ *
+ * @param bytes The most usable chunk bytes the stack may hold
+ */
+void tuscratch_set_limit(size_t bytes) {
+    thread_scratch.limit = bytes;
+}
@@ -0,0 +1,11 @@
+#ifndef CYB3053_PROJECT2_SCRATCH_H
+#define CYB3053_PROJECT2_SCRATCH_H
+
+#include <stddef.h>
+
+void *tuscratch_mark(void);
+void *tuscratch_alloc(size_t size);
+void tuscratch_release(void *mark);
+void tuscratch_set_limit(size_t bytes);
+
+#endif //CYB3053_PROJECT2_SCRATCH_H
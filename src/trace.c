@@ -0,0 +1,211 @@
+#include "alloc.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef TUMALLOC_TRACE
+
+/**
+ * A thread's ring of its last TRACE_EVENTS events
+ *
+ * Only the owning thread writes events, and publishes each one by storing
+ * head afterwards, so recording takes no lock. Rings are never unmapped:
+ * when a thread exits its ring is handed to the next new thread, which
+ * keeps overwriting the oldest events.
+ */
+typedef struct trace_ring {
+    _Atomic uint64_t head; /**< Events ever written, the next one goes to head % TRACE_EVENTS */
+    _Atomic int owned; /**< Whether a live thread is writing to the ring */
+    struct trace_ring *next; /**< Next ring in trace_rings */
+    trace_event events[TRACE_EVENTS]; /**< The events */
+} trace_ring;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER; /**< Protects the ring list */
+static trace_ring *trace_rings = NULL; /**< Every ring ever mapped */
+static size_t trace_nrings = 0; /**< Length of trace_rings */
+static _Atomic uint32_t trace_threads = 0; /**< Thread numbers handed out */
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT; /**< Creates trace_key */
+static pthread_key_t trace_key; /**< Runs trace_exit when a thread with a ring exits */
+static _Thread_local trace_ring *trace_self = NULL; /**< The thread's ring, NULL until it first traces */
+static _Thread_local uint16_t trace_thread = 0; /**< The thread's number */
+
+/**
+ * Give up the thread's ring at thread exit
+ *
+ * @param arg The ring
+ */
+static void trace_exit(void *arg) {
+    atomic_store_explicit(&((trace_ring *)arg)->owned, 0, memory_order_release);
+}
+
+/**
+ * Create the thread exit key, once per process
+ */
+static void trace_key_init(void) {
+    pthread_key_create(&trace_key, trace_exit);
+}
+
+/**
+ * Find a ring for the thread, reusing one left by an exited thread
+ *
+ * @return The ring, or NULL if none can be mapped
+ */
+static trace_ring *trace_attach(void) {
+    pthread_once(&trace_once, trace_key_init);
+
+    pthread_mutex_lock(&trace_lock);
+    trace_ring *ring = trace_rings;
+    for (; ring; ring = ring->next) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&ring->owned, &expected, 1)) break;
+    }
+    if (ring == NULL) {
+        void *mem = mmap(NULL, sizeof(trace_ring), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem != MAP_FAILED) {
+            ring = mem;
+            atomic_store(&ring->owned, 1);
+            ring->next = trace_rings;
+            trace_rings = ring;
+            trace_nrings++;
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+
+    if (ring) {
+        trace_thread = (uint16_t)atomic_fetch_add(&trace_threads, 1);
+        pthread_setspecific(trace_key, ring);
+    }
+    return ring;
+}
+
+/**
+ * Record an event in the thread's ring, called through TRACE
+ *
+ * @param op What happened
+ * @param ptr The block, or as the op says
+ * @param size The size, or as the op says
+ * @param arg Extra argument of the op
+ */
+void trace_event_record(trace_op op, const void *ptr, uint64_t size, uint32_t arg) {
+    trace_ring *ring = trace_self;
+    if (ring == NULL && (ring = trace_self = trace_attach()) == NULL) {
+        return;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    trace_event *e = &ring->events[head & (TRACE_EVENTS - 1)];
+    e->ts = (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+    e->ptr = (uint64_t)(uintptr_t)ptr;
+    e->size = size;
+    e->arg = arg;
+    e->op = (uint16_t)op;
+    e->thread = trace_thread;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * Write a whole buffer to a file
+ *
+ * @param fd The file
+ * @param buf The bytes
+ * @param len Number of bytes
+ * @return 0 on success, -1 on a write error
+ */
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *at = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, at, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        at += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+#endif
+
+/**
+ * Dump the trace rings of all threads to a file for tutrace
+ *
+ * The file is a trace_file header followed by the events of each ring,
+ * oldest first within a ring; tutrace merges them by time. Threads keep
+ * tracing during the dump, and events they overwrite while their ring is
+ * copied are left out rather than written torn. Only available when built
+ * with TUMALLOC_TRACE.
+ *
+ * @param path The file to write
+ * @return 0 on success, -1 with errno set if the file cannot be written,
+ *         or to ENOSYS if tracing is compiled out
+ */
+int tumalloc_trace_dump(const char *path) {
+#ifdef TUMALLOC_TRACE
+    pthread_mutex_lock(&trace_lock);
+    size_t nrings = trace_nrings;
+    trace_ring *rings = trace_rings;
+    pthread_mutex_unlock(&trace_lock);
+
+    // Copied out of the rings first, so the file is written from a stable buffer
+    size_t len = (nrings ? nrings : 1) * sizeof(trace_event) * TRACE_EVENTS;
+    trace_event *events = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (events == MAP_FAILED) {
+        return -1;
+    }
+    size_t count = 0;
+    size_t i = 0;
+    for (trace_ring *ring = rings; ring && i < nrings; ring = ring->next, i++) {
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t first = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+        for (uint64_t n = first; n < head; n++) {
+            events[count + (n - first)] = ring->events[n & (TRACE_EVENTS - 1)];
+        }
+
+        // Slots the owner reused while they were copied are dropped
+        uint64_t now = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t valid = now > TRACE_EVENTS ? now - TRACE_EVENTS : 0;
+        if (valid > first) {
+            size_t skip = valid - first < head - first ? (size_t)(valid - first) : (size_t)(head - first);
+            memmove(&events[count], &events[count + skip], (size_t)(head - first - skip) * sizeof(trace_event));
+            count += (size_t)(head - first - skip);
+        } else {
+            count += (size_t)(head - first);
+        }
+    }
+
+    trace_file hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.event_size = sizeof(trace_event);
+    hdr.threads = (uint32_t)nrings;
+    hdr.count = count;
+
+    int rc = -1;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        rc = write_all(fd, &hdr, sizeof(hdr)) == 0 && write_all(fd, events, count * sizeof(trace_event)) == 0 ? 0 : -1;
+        int saved = errno;
+        if (close(fd) != 0 && rc == 0) {
+            rc = -1;
+        } else {
+            errno = saved;
+        }
+    }
+    munmap(events, len);
+    return rc;
+#else
+    (void)path;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
@@ -0,0 +1,64 @@
+#ifndef CYB3053_PROJECT2_TRACE_H
+#define CYB3053_PROJECT2_TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC "TUTRACE1" /**< First eight bytes of a trace dump */
+#define TRACE_EVENTS 8192 /**< Events kept per thread, a power of two */
+
+/**
+ * What a trace event records, one per former printf in the allocator
+ */
+typedef enum trace_op {
+    TRACE_MALLOC = 1, /**< tumalloc called: size requested, ptr the arena's next fit pointer, arg the arena */
+    TRACE_BIN, /**< Block handed out from a size-class bin */
+    TRACE_SPLIT, /**< Block split off the tail of a free block */
+    TRACE_FIT, /**< Free block handed out whole */
+    TRACE_GROW, /**< Block carved from newly grown heap */
+    TRACE_GROW_FAIL, /**< The heap could not grow: ptr is NULL */
+    TRACE_MAP, /**< Block given its own mapping */
+    TRACE_TCACHE, /**< Block handed out from the thread cache */
+    TRACE_ALIGNED, /**< tualigned_alloc returned: arg the alignment */
+    TRACE_CALLOC, /**< tucalloc needs fresh memory: size the total */
+    TRACE_REALLOC, /**< turealloc called: ptr the old block, size the new size */
+    TRACE_MALLOCX, /**< tumallocx called: arg the flags */
+    TRACE_BATCH, /**< tumalloc_batch returned: ptr the output array, arg the blocks allocated */
+    TRACE_FREE, /**< tufree or tufree_sized called */
+    TRACE_BIN_FREE, /**< Block returned to its size-class bin */
+    TRACE_LIST_FREE, /**< Block returned to the free list */
+    TRACE_MAP_FREE, /**< Mapping released to the cache */
+    TRACE_TCACHE_FREE, /**< Block returned to the thread cache */
+    TRACE_BATCH_FREE, /**< tufree_batch returned: ptr the input array, arg the blocks freed */
+    TRACE_OPS /**< Number of op codes plus one */
+} trace_op;
+
+/**
+ * One binary trace record, written as-is to the dump
+ */
+typedef struct trace_event {
+    uint64_t ts; /**< CLOCK_MONOTONIC time in ns */
+    uint64_t ptr; /**< The block, or as the op says */
+    uint64_t size; /**< The size, or as the op says */
+    uint32_t arg; /**< Extra argument of the op */
+    uint16_t op; /**< A trace_op */
+    uint16_t thread; /**< Number of the thread, in the order threads first traced */
+} trace_event;
+
+/**
+ * Header of a trace dump, followed by count events of event_size bytes
+ */
+typedef struct trace_file {
+    char magic[8]; /**< TRACE_MAGIC */
+    uint32_t event_size; /**< sizeof(trace_event) */
+    uint32_t threads; /**< Number of thread rings dumped */
+    uint64_t count; /**< Number of events that follow */
+} trace_file;
+
+#ifdef TUMALLOC_TRACE
+void trace_event_record(trace_op op, const void *ptr, uint64_t size, uint32_t arg);
+#define TRACE(op, ptr, size, arg) trace_event_record((op), (ptr), (size), (arg)) /**< Record an event */
+#else
+#define TRACE(op, ptr, size, arg) ((void)0) /**< Tracing is compiled out, the arguments are not evaluated */
+#endif
+
+#endif //CYB3053_PROJECT2_TRACE_H
@@ -0,0 +1,195 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Compare two heap snapshots written by tumalloc_snapshot
+ *
+ * Usage: tusnapdiff [-n count] before.snap after.snap
+ *
+ * Prints the change in allocated bytes, then the size classes and the
+ * allocation sites whose live bytes grew the most. Site numbers are scaled
+ * up from the profiler's samples, so they are estimates; class numbers
+ * are exact. Addresses can be resolved with addr2line against the binary,
+ * since both snapshots come from the same process.
+ */
+
+#define LINE_MAX_LEN 4096 /**< Longest line read from a snapshot */
+#define TOP_DEFAULT 10 /**< Entries printed per table unless -n says otherwise */
+
+/**
+ * A size class or site present in either snapshot
+ */
+typedef struct entry {
+    char *key; /**< The class size or the site's addresses */
+    int is_site; /**< Whether this is a site rather than a class */
+    double before_blocks; /**< Live blocks in the first snapshot */
+    double before_bytes; /**< Live bytes in the first snapshot */
+    double after_blocks; /**< Live blocks in the second snapshot */
+    double after_bytes; /**< Live bytes in the second snapshot */
+} entry;
+
+/**
+ * Totals of one snapshot
+ */
+typedef struct snapshot {
+    double rate; /**< Mean bytes between samples */
+    double allocated; /**< Usable bytes of live blocks */
+    double active; /**< The same including headers and mapping rounding */
+} snapshot;
+
+static entry *entries = NULL; /**< All classes and sites */
+static size_t nentries = 0; /**< Number of entries */
+static size_t capacity = 0; /**< Allocated length of entries */
+
+/**
+ * Find an entry, adding it if it is new
+ *
+ * @param key The class size or the site's addresses
+ * @param is_site Whether the key is a site
+ * @return The entry
+ */
+static entry *lookup(const char *key, int is_site) {
+    for (size_t i = 0; i < nentries; i++) {
+        if (entries[i].is_site == is_site && strcmp(entries[i].key, key) == 0) {
+            return &entries[i];
+        }
+    }
+    if (nentries == capacity) {
+        capacity = capacity ? capacity * 2 : 64;
+        entries = realloc(entries, capacity * sizeof(entry));
+        if (entries == NULL) {
+            perror("tusnapdiff");
+            exit(1);
+        }
+    }
+    entry *e = &entries[nentries++];
+    memset(e, 0, sizeof(*e));
+    e->key = strdup(key);
+    e->is_site = is_site;
+    return e;
+}
+
+/**
+ * Scale sampled numbers back to the whole heap
+ *
+ * A block of size s is sampled with probability 1 - exp(-s / rate).
+ *
+ * @param blocks The sampled blocks, scaled in place
+ * @param bytes Their bytes, scaled in place
+ * @param rate The sampling rate
+ */
+static void unsample(double *blocks, double *bytes, double rate) {
+    if (*blocks <= 0 || rate <= 0) {
+        return;
+    }
+    double scale = 1.0 / (1.0 - exp(-(*bytes / *blocks) / rate));
+    *blocks *= scale;
+    *bytes *= scale;
+}
+
+/**
+ * Read a snapshot into the entries
+ *
+ * @param path The snapshot file
+ * @param after 0 for the first snapshot, 1 for the second
+ * @param snap Filled with the snapshot's totals
+ */
+static void load(const char *path, int after, snapshot *snap) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        perror(path);
+        exit(1);
+    }
+
+    char line[LINE_MAX_LEN];
+    if (fgets(line, sizeof(line), in) == NULL || strcmp(line, "tumalloc snapshot 1\n") != 0) {
+        fprintf(stderr, "%s: not a tumalloc snapshot\n", path);
+        exit(1);
+    }
+    memset(snap, 0, sizeof(*snap));
+    while (fgets(line, sizeof(line), in)) {
+        line[strcspn(line, "\n")] = '\0';
+        double blocks, bytes;
+        char key[64];
+        int used = 0;
+        if (sscanf(line, "rate %lf", &snap->rate) == 1 || sscanf(line, "allocated %lf", &snap->allocated) == 1 ||
+            sscanf(line, "active %lf", &snap->active) == 1) {
+            continue;
+        }
+        if (sscanf(line, "class %63s %lf %lf", key, &blocks, &bytes) == 3) {
+            entry *e = lookup(key, 0);
+            *(after ? &e->after_blocks : &e->before_blocks) = blocks;
+            *(after ? &e->after_bytes : &e->before_bytes) = bytes;
+        } else if (sscanf(line, "site %lf %lf @%n", &blocks, &bytes, &used) == 2 && used > 0) {
+            unsample(&blocks, &bytes, snap->rate);
+            entry *e = lookup(line + used, 1);
+            *(after ? &e->after_blocks : &e->before_blocks) = blocks;
+            *(after ? &e->after_bytes : &e->before_bytes) = bytes;
+        }
+    }
+    fclose(in);
+}
+
+/**
+ * Order entries by growth in bytes, largest first
+ *
+ * @param a The first entry
+ * @param b The second entry
+ * @return Negative if a grew more than b
+ */
+static int by_growth(const void *a, const void *b) {
+    const entry *x = a;
+    const entry *y = b;
+    double dx = x->after_bytes - x->before_bytes;
+    double dy = y->after_bytes - y->before_bytes;
+    return dx > dy ? -1 : dx < dy;
+}
+
+/**
+ * Print the entries of one kind that grew the most
+ *
+ * @param is_site Whether to print sites rather than classes
+ * @param top The most entries to print
+ */
+static void print_top(int is_site, int top) {
+    int printed = 0;
+    for (size_t i = 0; i < nentries && printed < top; i++) {
+        entry *e = &entries[i];
+        if (e->is_site != is_site || e->after_bytes <= e->before_bytes) continue;
+        printf("  %+14.0f B %+10.0f blocks  (%.0f -> %.0f B)  %s%s\n", e->after_bytes - e->before_bytes,
+               e->after_blocks - e->before_blocks, e->before_bytes, e->after_bytes, is_site ? "@" : "size ", e->key);
+        printed++;
+    }
+    if (printed == 0) {
+        printf("  none grew\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    int top = TOP_DEFAULT;
+    int arg = 1;
+    if (arg + 1 < argc && strcmp(argv[arg], "-n") == 0) {
+        top = atoi(argv[arg + 1]);
+        arg += 2;
+    }
+    if (argc - arg != 2) {
+        fprintf(stderr, "usage: %s [-n count] before.snap after.snap\n", argv[0]);
+        return 2;
+    }
+
+    snapshot before, after;
+    load(argv[arg], 0, &before);
+    load(argv[arg + 1], 1, &after);
+    qsort(entries, nentries, sizeof(entry), by_growth);
+
+    printf("allocated: %.0f -> %.0f B (%+.0f)\n", before.allocated, after.allocated,
+           after.allocated - before.allocated);
+    printf("active:    %.0f -> %.0f B (%+.0f)\n", before.active, after.active, after.active - before.active);
+    printf("size classes that grew the most:\n");
+    print_top(0, top);
+    printf("sites that grew the most (estimated from samples):\n");
+    print_top(1, top);
+    return 0;
+}
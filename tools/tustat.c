@@ -0,0 +1,136 @@
+#include "export.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Print the allocator statistics a process publishes with tumalloc_stats_export
+ *
+ * Usage: tustat [-i ms] segment
+ *
+ * The segment is the file passed to tumalloc_stats_export, or
+ * /proc/<pid>/fd/<fd> for a memfd. It is mapped read-only and never
+ * written, so the process is not disturbed. With -i the statistics are
+ * printed again every ms milliseconds, with the calls per second since the
+ * previous read.
+ */
+
+#define RETRIES 1000 /**< Reads of a segment whose seqlock stays odd before giving up */
+
+/**
+ * Copy a consistent snapshot out of the segment
+ *
+ * @param seg The mapped segment
+ * @param out Receives the header and statistics
+ * @return 0 on success, -1 if the writer never finished an update
+ */
+static int snapshot(const export_page *seg, export_page *out) {
+    for (int i = 0; i < RETRIES; i++) {
+        uint64_t before = atomic_load_explicit(&((export_page *)seg)->seq, memory_order_acquire);
+        if (before & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(out, seg, sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        uint64_t after = atomic_load_explicit(&((export_page *)seg)->seq, memory_order_relaxed);
+        if (before == after) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Get the current monotonic time
+ *
+ * @return The time in nanoseconds
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Print one snapshot
+ *
+ * @param snap The snapshot
+ * @param prev The previous snapshot, or NULL
+ */
+static void print_snapshot(const export_page *snap, const export_page *prev) {
+    const tustats *s = &snap->stats;
+    double age = (double)(now_ns() - snap->published_ns) / 1e6;
+    printf("pid %" PRIu64 "  publish %" PRIu64 "  %.0f ms ago\n", snap->pid, snap->publishes, age);
+    printf("  allocated %zu  active %zu  mapped %zu  retained %zu\n", s->allocated, s->active, s->mapped,
+           s->retained);
+    printf("  nmalloc %zu  nfree %zu  nrealloc %zu  tcache hits %zu misses %zu\n", s->nmalloc, s->nfree,
+           s->nrealloc, s->tcache_hits, s->tcache_misses);
+    printf("  large cache %zu B in %zu mappings  pressure %d  purged %zu\n", s->large_cache_bytes,
+           s->large_cache_mappings, s->pressure_level, s->purged_bytes);
+    if (prev && snap->published_ns > prev->published_ns) {
+        double secs = (double)(snap->published_ns - prev->published_ns) / 1e9;
+        printf("  %.0f malloc/s  %.0f free/s\n", (double)(s->nmalloc - prev->stats.nmalloc) / secs,
+               (double)(s->nfree - prev->stats.nfree) / secs);
+    }
+}
+
+int main(int argc, char **argv) {
+    long interval = 0;
+    int arg = 1;
+    if (arg + 1 < argc && strcmp(argv[arg], "-i") == 0) {
+        interval = atol(argv[arg + 1]);
+        arg += 2;
+    }
+    if (argc - arg != 1) {
+        fprintf(stderr, "usage: %s [-i ms] segment\n", argv[0]);
+        return 2;
+    }
+
+    int fd = open(argv[arg], O_RDONLY);
+    if (fd < 0) {
+        perror(argv[arg]);
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(export_page)) {
+        fprintf(stderr, "%s: not a tumalloc stats segment of version %d\n", argv[arg], EXPORT_VERSION);
+        return 1;
+    }
+    const export_page *seg = mmap(NULL, sizeof(export_page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {
+        perror(argv[arg]);
+        return 1;
+    }
+    if (seg->magic != EXPORT_MAGIC || seg->version != EXPORT_VERSION || seg->page_size != sizeof(export_page)) {
+        fprintf(stderr, "%s: not a tumalloc stats segment of version %d\n", argv[arg], EXPORT_VERSION);
+        return 1;
+    }
+
+    export_page snap, prev;
+    int have_prev = 0;
+    for (;;) {
+        if (snapshot(seg, &snap) != 0) {
+            fprintf(stderr, "%s: writer stuck in an update\n", argv[arg]);
+            return 1;
+        }
+        print_snapshot(&snap, have_prev ? &prev : NULL);
+        if (interval <= 0) break;
+
+        fflush(stdout);
+        prev = snap;
+        have_prev = 1;
+        struct timespec ts = {interval / 1000, (interval % 1000) * 1000000};
+        nanosleep(&ts, NULL);
+    }
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include "trace.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Decode a trace dump written by tumalloc_trace_dump
+ *
+ * Usage: tutrace trace.bin
+ *
+ * Prints one line per event, all threads merged in time order: the time
+ * in microseconds since the first event, the thread number, the op, then
+ * the pointer, size and extra argument as the op uses them.
+ */
+
+/**
+ * Names of the ops, indexed by trace_op
+ */
+static const char *op_names[TRACE_OPS] = {
+    [TRACE_MALLOC] = "malloc",
+    [TRACE_BIN] = "bin",
+    [TRACE_SPLIT] = "split",
+    [TRACE_FIT] = "fit",
+    [TRACE_GROW] = "grow",
+    [TRACE_GROW_FAIL] = "grow-fail",
+    [TRACE_MAP] = "map",
+    [TRACE_TCACHE] = "tcache",
+    [TRACE_ALIGNED] = "aligned",
+    [TRACE_CALLOC] = "calloc",
+    [TRACE_REALLOC] = "realloc",
+    [TRACE_MALLOCX] = "mallocx",
+    [TRACE_BATCH] = "batch",
+    [TRACE_FREE] = "free",
+    [TRACE_BIN_FREE] = "bin-free",
+    [TRACE_LIST_FREE] = "list-free",
+    [TRACE_MAP_FREE] = "map-free",
+    [TRACE_TCACHE_FREE] = "tcache-free",
+    [TRACE_BATCH_FREE] = "batch-free",
+};
+
+/**
+ * Order events by time, then by thread
+ *
+ * @param a The first event
+ * @param b The second event
+ * @return Negative if a comes first
+ */
+static int by_time(const void *a, const void *b) {
+    const trace_event *x = a;
+    const trace_event *y = b;
+    if (x->ts != y->ts) return x->ts < y->ts ? -1 : 1;
+    return (int)x->thread - (int)y->thread;
+}
+
+/**
+ * Print one event
+ *
+ * @param e The event
+ * @param start Time of the first event
+ */
+static void print_event(const trace_event *e, uint64_t start) {
+    const char *name = e->op < TRACE_OPS && op_names[e->op] ? op_names[e->op] : "?";
+    printf("%12.3f t%-5u %-11s", (double)(e->ts - start) / 1000.0, (unsigned)e->thread, name);
+    switch (e->op) {
+        case TRACE_MALLOC:
+            printf(" size %" PRIu64 " arena %" PRIu32 " next_fit %#" PRIx64 "\n", e->size, e->arg, e->ptr);
+            break;
+        case TRACE_CALLOC:
+        case TRACE_GROW_FAIL:
+            printf(" size %" PRIu64 "\n", e->size);
+            break;
+        case TRACE_MALLOCX:
+            printf(" size %" PRIu64 " flags %#" PRIx32 "\n", e->size, e->arg);
+            break;
+        case TRACE_ALIGNED:
+            printf(" %#" PRIx64 " size %" PRIu64 " align %" PRIu32 "\n", e->ptr, e->size, e->arg);
+            break;
+        case TRACE_REALLOC:
+            printf(" %#" PRIx64 " to size %" PRIu64 "\n", e->ptr, e->size);
+            break;
+        case TRACE_BATCH:
+            printf(" %" PRIu32 " blocks of size %" PRIu64 " into %#" PRIx64 "\n", e->arg, e->size, e->ptr);
+            break;
+        case TRACE_BATCH_FREE:
+            printf(" %" PRIu32 " blocks from %#" PRIx64 "\n", e->arg, e->ptr);
+            break;
+        case TRACE_FREE:
+        case TRACE_MAP_FREE:
+            printf(" %#" PRIx64 "\n", e->ptr);
+            break;
+        default:
+            printf(" %#" PRIx64 " size %" PRIu64 "\n", e->ptr, e->size);
+            break;
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s trace.bin\n", argv[0]);
+        return 2;
+    }
+    FILE *in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    trace_file hdr;
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 || memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0) {
+        fprintf(stderr, "%s: not a tumalloc trace\n", argv[1]);
+        return 1;
+    }
+    if (hdr.event_size != sizeof(trace_event)) {
+        fprintf(stderr, "%s: events are %" PRIu32 " bytes, expected %zu\n", argv[1], hdr.event_size,
+                sizeof(trace_event));
+        return 1;
+    }
+
+    trace_event *events = hdr.count ? malloc(hdr.count * sizeof(trace_event)) : NULL;
+    if (hdr.count && events == NULL) {
+        perror("tutrace");
+        return 1;
+    }
+    size_t count = fread(events, sizeof(trace_event), hdr.count, in);
+    fclose(in);
+    if (count != hdr.count) {
+        fprintf(stderr, "%s: truncated, %zu of %" PRIu64 " events\n", argv[1], count, hdr.count);
+    }
+
+    qsort(events, count, sizeof(trace_event), by_time);
+    printf("%zu events from %" PRIu32 " threads\n", count, hdr.threads);
+    for (size_t i = 0; i < count; i++) {
+        print_event(&events[i], events[0].ts);
+    }
+    free(events);
+    return 0;
+}